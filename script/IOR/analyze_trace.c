@@ -0,0 +1,166 @@
+/**
+ * analyze_trace.c
+ *
+ * Compares the logical and physical seek distances of a filtered trace
+ * against the current layout of a data file, without replaying it.
+ *
+ * The extent list of the data file is read with FS_IOC_FIEMAP (see
+ * extents.h) and every read or write of file 0 is mapped to its physical
+ * address. Logical and physical seeks are both measured from the end of the
+ * previous request to the start of the next one, the distance the head
+ * travels, so a sequential run seeks 0 bytes on both sides. Requests crossing
+ * a discontinuity of the mapping (a fragment boundary or a hole) are counted.
+ *
+ * The trace is streamed, so memory use does not depend on its length. With
+ * --per-request, one line per request goes to stdout and the summary to
+ * stderr; otherwise the summary goes to stdout.
+ *
+ */
+
+#include "trace.h"      // For IOReq and the streaming reader.
+#include "extents.h"    // For the extent index of the data file.
+#include <stdio.h>      // For printf, fprintf.
+#include <stdlib.h>     // For EXIT_FAILURE.
+#include <string.h>     // For strcmp.
+#include <stdint.h>     // For uint64_t.
+#include <inttypes.h>   // For PRIu64.
+
+#define NB_SEEK_BKT   64         /* log2 buckets of the seek distances */
+#define CHUNK_REQS    65536      /* Requests per streamed chunk */
+
+// Seek distances of the mapped requests
+typedef struct {
+    size_t   hist[NB_SEEK_BKT];  /* Requests per log2 bucket */
+    double   sum;                /* Sum of the distances in bytes */
+    uint64_t max;
+} SeekStats;
+
+
+/**
+ * @brief Returns the log2 bucket of a value: 0 for 0, floor(log2(v)) + 1 otherwise.
+ */
+static unsigned log2_bucket(uint64_t v) {
+    unsigned b = 0;
+    while (v) { b++; v >>= 1; }
+    return b < NB_SEEK_BKT ? b : NB_SEEK_BKT - 1;
+}
+
+
+/**
+ * @brief Returns the lower bound of the bucket holding quantile q.
+ */
+static uint64_t seek_quantile(const SeekStats *s, size_t n, double q) {
+    size_t target = (size_t)(q * n), cum = 0;
+    for (unsigned b = 0; b < NB_SEEK_BKT; ++b) {
+        cum += s->hist[b];
+        if (cum > target) return b ? 1ULL << (b - 1) : 0;
+    }
+    return s->max;
+}
+
+
+static void seek_add(SeekStats *s, uint64_t d) {
+    s->hist[log2_bucket(d)]++;
+    s->sum += (double)d;
+    if (d > s->max) s->max = d;
+}
+
+
+int main(int argc, char **argv) {
+    const char *data_path = NULL, *trace_path = NULL;
+    int per_request = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--data-file") && i + 1 < argc) data_path = argv[++i];
+        else if (!strcmp(argv[i], "--per-request")) per_request = 1;
+        else trace_path = argv[i];
+    }
+    if (!data_path || !trace_path) {
+        fprintf(stderr, "Usage: %s --data-file <path> [--per-request] <filtered_trace>\n", argv[0]);
+        fprintf(stderr, "  --per-request   Print op, offset, length, physical address, logical seek,\n");
+        fprintf(stderr, "                  physical seek and extent crossings of every request\n");
+        return EXIT_FAILURE;
+    }
+
+    ExtentMap map;
+    if (extent_map_load(&map, data_path) < 0) return EXIT_FAILURE;
+    TraceStream *stream = trace_stream_open(trace_path, CHUNK_REQS, 3);
+    if (!stream) {
+        extent_map_free(&map);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = per_request ? stderr : stdout;
+    if (per_request) printf("op offset length physical logical_seek physical_seek crossings\n");
+
+    SeekStats logical = { {0}, 0, 0 }, physical = { {0}, 0, 0 };
+    ExtentCursor cursor = { 0, 0, 0 };
+    size_t mapped = 0, unmapped = 0, skipped = 0, crossings = 0, crossing_ops = 0, out_of_file = 0;
+    IOReq *reqs;
+    size_t n;
+    while ((n = trace_stream_next(stream, &reqs)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            const IOReq *r = &reqs[i];
+            if (!IS_DATA_OP(r->op_type) || r->file != 0 || r->offset < 0) {
+                skipped++;
+                continue;
+            }
+            // Past the end of the file: no extent, and not a hole either
+            if ((uint64_t)r->offset >= map.file_size) {
+                out_of_file++;
+                if (per_request) printf("%d %ld %d - - - 0\n", r->op_type, r->offset, r->length);
+                continue;
+            }
+
+            uint64_t phys = 0, seek = 0, phys_seek = 0;
+            size_t cross;
+            int ok = extent_request(&map, &cursor, (uint64_t)r->offset, (uint64_t)r->length,
+                                    &phys, &seek, &phys_seek, &cross);
+            crossings += cross;
+            if (cross > 0) crossing_ops++;
+            if (ok == 0) {
+                mapped++;
+                seek_add(&logical, seek);
+                seek_add(&physical, phys_seek);
+            } else {
+                unmapped++;
+            }
+            if (per_request) {
+                if (ok == 0)
+                    printf("%d %ld %d %" PRIu64 " %" PRIu64 " %" PRIu64 " %zu\n",
+                           r->op_type, r->offset, r->length, phys, seek, phys_seek, cross);
+                else
+                    printf("%d %ld %d - - - %zu\n", r->op_type, r->offset, r->length, cross);
+            }
+        }
+    }
+    TraceStreamStats st;
+    trace_stream_close(stream, &st);
+
+    ExtentSummary es;
+    extent_summary(&map, &es);
+    fprintf(out, "Data file           : %" PRIu64 " bytes, %zu extents in %zu fragments, %zu holes, %zu unwritten\n",
+            map.file_size, es.extents, es.fragments, es.holes, es.unwritten);
+    fprintf(out, "Fragments           : median %" PRIu64 " KiB, largest %" PRIu64 " KiB, mapped %.2f%%, physical span %" PRIu64 " MiB\n",
+            es.median / 1024, es.largest / 1024,
+            map.file_size ? 100.0 * es.mapped_bytes / map.file_size : 0.0, es.span >> 20);
+    fprintf(out, "Requests            : %zu mapped, %zu in holes, %zu beyond the end of file, %zu other ops skipped\n",
+            mapped, unmapped, out_of_file, skipped);
+    if (mapped > 0) {
+        fprintf(out, "Seek (bytes)        : %14s %14s %14s %14s\n", "mean", "median >=", "p90 >=", "max");
+        fprintf(out, "  logical           : %14.0f %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n", logical.sum / mapped,
+                seek_quantile(&logical, mapped, 0.5), seek_quantile(&logical, mapped, 0.9), logical.max);
+        fprintf(out, "  physical          : %14.0f %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n", physical.sum / mapped,
+                seek_quantile(&physical, mapped, 0.5), seek_quantile(&physical, mapped, 0.9), physical.max);
+        if (logical.sum > 0)
+            fprintf(out, "Physical / logical  : %.3f (total seek distance)\n", physical.sum / logical.sum);
+        else
+            fprintf(out, "Physical / logical  : - (sequential trace, %.0f bytes of physical seeks)\n", physical.sum);
+    }
+    fprintf(out, "Extent crossings    : %zu, %.3f per request, %zu requests crossing\n", crossings,
+            mapped + unmapped ? (double)crossings / (mapped + unmapped) : 0.0, crossing_ops);
+    if (st.error) fprintf(stderr, "WARNING: the trace could not be read to the end.\n");
+
+    extent_map_free(&map);
+    return EXIT_SUCCESS;
+}
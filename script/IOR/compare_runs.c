@@ -0,0 +1,469 @@
+/**
+ * compare_runs.c
+ *
+ * Statistical comparison of replay runs, from the read and write latencies
+ * written by iortest1 --latency-log (one value in microseconds per line).
+ *
+ * The first run is the baseline and every other run is compared with it:
+ *  - bootstrap confidence intervals of the difference (run - baseline) of
+ *    the mean, the median and the p99 latency. Latencies are heavy-tailed,
+ *    so the intervals are percentile intervals of the resampled differences
+ *    rather than a normal approximation;
+ *  - a Mann-Whitney U test (normal approximation with tie correction) and
+ *    the probability that an op of the run is slower than one of the
+ *    baseline.
+ * With more than two runs, the confidence level is Bonferroni-corrected for
+ * the number of comparisons.
+ *
+ * Latencies are whole microseconds, so a run is held as its sorted distinct
+ * values and their counts, built without sorting the samples. Resampling
+ * uses the Poisson bootstrap: each distinct value is drawn Poisson(count)
+ * times, which for large runs is equivalent to drawing n samples with
+ * replacement and costs O(distinct values) instead of O(n) per replicate.
+ * Replicates are spread over threads; each one has its own seed, so the
+ * result does not depend on the number of threads.
+ *
+ */
+
+#include <stdio.h>      // For printf, fprintf, perror.
+#include <stdlib.h>     // For malloc, calloc, qsort, strtoul.
+#include <string.h>     // For strcmp.
+#include <stdint.h>     // For uint64_t.
+#include <math.h>       // For sqrt, log, lgamma, erfc.
+#include <fcntl.h>      // For open.
+#include <unistd.h>     // For read, close, sysconf.
+#include <pthread.h>    // For the bootstrap threads.
+#include <sys/time.h>   // For gettimeofday.
+
+#define DENSE_MAX    (1 << 20)   /* Latencies below this (us) are counted in a dense array */
+#define READ_BLOCK   (1 << 20)   /* Bytes read at a time from a latency file */
+#define MAX_THREADS  256
+
+// Latencies of one run, as sorted distinct values and their counts
+typedef struct {
+    const char *path;
+    size_t    n;          /* Number of latencies */
+    size_t    k;          /* Number of distinct values */
+    uint64_t *val;        /* Distinct latencies in us, increasing */
+    size_t   *cnt;        /* Occurrences of each value */
+    double    mean;
+    uint64_t  median;
+    uint64_t  p99;
+} Run;
+
+// Replicates computed by one thread
+typedef struct {
+    const Run *base, *run;
+    size_t    first, last;   /* Replicates [first, last) */
+    uint64_t  seed;
+    double   *d_mean, *d_median, *d_p99;   /* Differences run - baseline, per replicate */
+} BootJob;
+
+
+static uint64_t splitmix64(uint64_t *s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+static double uniform(uint64_t *s) {
+    return (splitmix64(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * @brief Draws a Poisson variate: multiplication method for small means,
+ * transformed rejection (PTRS, Hormann 1993) for the others.
+ */
+static uint64_t poisson(uint64_t *s, double lam) {
+    if (lam < 10.0) {
+        double l = exp(-lam), p = uniform(s);
+        uint64_t k = 0;
+        while (p > l) { k++; p *= uniform(s); }
+        return k;
+    }
+    double slam = sqrt(lam), loglam = log(lam);
+    double b = 0.931 + 2.53 * slam, a = -0.059 + 0.02483 * b;
+    double invalpha = 1.1239 + 1.1328 / (b - 3.4), vr = 0.9277 - 3.6224 / (b - 2);
+    for (;;) {
+        double u = uniform(s) - 0.5, v = uniform(s), us = 0.5 - fabs(u);
+        double k = floor((2 * a / us + b) * u + lam + 0.43);
+        if (us >= 0.07 && v <= vr) return (uint64_t)k;
+        if (k < 0 || (us < 0.013 && v > us)) continue;
+        if (log(v) + log(invalpha) - log(a / (us * us) + b) <= -lam + k * loglam - lgamma(k + 1))
+            return (uint64_t)k;
+    }
+}
+
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Returns the value holding quantile q of a weighted distribution,
+ * with the convention of iortest1 (the value at sorted index floor(q * n)).
+ */
+static uint64_t weighted_quantile(const uint64_t *val, const size_t *w, size_t k, size_t total, double q) {
+    size_t target = (size_t)(q * total), cum = 0;
+    for (size_t i = 0; i < k; ++i) {
+        cum += w[i];
+        if (cum > target) return val[i];
+    }
+    return k ? val[k - 1] : 0;
+}
+
+
+/**
+ * @brief Counts one latency: in the dense array, or in the spill list.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int add_latency(size_t *dense, uint64_t **spill, size_t *nb_spill, size_t *cap_spill, uint64_t v) {
+    if (v < DENSE_MAX) {
+        dense[v]++;
+        return 0;
+    }
+    if (*nb_spill == *cap_spill) {
+        size_t cap = *cap_spill ? *cap_spill * 2 : 4096;
+        uint64_t *p = realloc(*spill, cap * sizeof(uint64_t));
+        if (!p) return -1;
+        *spill = p;
+        *cap_spill = cap;
+    }
+    (*spill)[(*nb_spill)++] = v;
+    return 0;
+}
+
+
+/**
+ * @brief Loads a latency file. Small latencies are counted in a dense
+ * array, the rare large ones are collected and sorted apart.
+ * @param r The run to fill.
+ * @param path The file written by --latency-log.
+ * @return 0 on success, -1 on failure.
+ */
+static int load_run(Run *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+
+    size_t *dense = calloc(DENSE_MAX, sizeof(size_t));
+    char *block = malloc(READ_BLOCK);
+    uint64_t *spill = NULL;
+    size_t nb_spill = 0, cap_spill = 0, bad_lines = 0;
+    if (!dense || !block) {
+        perror("malloc latency file");
+        free(dense); free(block); close(fd);
+        return -1;
+    }
+
+    // Lines are parsed across block boundaries: v, digits and bad carry over
+    uint64_t v = 0;
+    int digits = 0, bad = 0;
+    ssize_t got;
+    while ((got = read(fd, block, READ_BLOCK)) > 0) {
+        for (ssize_t i = 0; i < got; ++i) {
+            char c = block[i];
+            if (c >= '0' && c <= '9') {
+                v = v * 10 + (uint64_t)(c - '0');
+                digits++;
+            } else if (c == '\n') {
+                if (digits && !bad) {
+                    if (add_latency(dense, &spill, &nb_spill, &cap_spill, v) < 0) { got = -1; break; }
+                    r->n++;
+                } else if (digits || bad) {
+                    bad_lines++;
+                }
+                v = 0; digits = 0; bad = 0;
+            } else if (c != ' ' && c != '\t' && c != '\r') {
+                bad = 1;
+            }
+        }
+        if (got < 0) break;
+    }
+    // Last line without a newline
+    if (got == 0 && digits && !bad) {
+        if (add_latency(dense, &spill, &nb_spill, &cap_spill, v) < 0) got = -1;
+        else r->n++;
+    }
+    if (got < 0) perror(path);
+    close(fd);
+    free(block);
+    if (bad_lines) fprintf(stderr, "WARNING: %s: %zu malformed lines skipped.\n", path, bad_lines);
+
+    qsort(spill, nb_spill, sizeof(uint64_t), cmp_u64);
+    size_t k = 0;
+    for (size_t i = 0; i < DENSE_MAX; ++i) k += dense[i] != 0;
+    for (size_t i = 0; i < nb_spill; ++i) k += (i == 0 || spill[i] != spill[i - 1]);
+    r->val = malloc((k ? k : 1) * sizeof(uint64_t));
+    r->cnt = malloc((k ? k : 1) * sizeof(size_t));
+    if (got < 0 || !r->val || !r->cnt) {
+        if (got >= 0) perror("malloc latency file");
+        free(dense); free(spill);
+        return -1;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < DENSE_MAX; ++i) {
+        if (!dense[i]) continue;
+        r->val[r->k] = i;
+        r->cnt[r->k++] = dense[i];
+        sum += (double)i * dense[i];
+    }
+    for (size_t i = 0; i < nb_spill; ++i) {
+        if (i == 0 || spill[i] != spill[i - 1]) {
+            r->val[r->k] = spill[i];
+            r->cnt[r->k++] = 0;
+        }
+        r->cnt[r->k - 1]++;
+        sum += (double)spill[i];
+    }
+    free(dense);
+    free(spill);
+
+    if (r->n == 0) {
+        fprintf(stderr, "Error: %s holds no latency.\n", path);
+        return -1;
+    }
+    r->mean = sum / r->n;
+    r->median = weighted_quantile(r->val, r->cnt, r->k, r->n, 0.5);
+    r->p99 = weighted_quantile(r->val, r->cnt, r->k, r->n, 0.99);
+    return 0;
+}
+
+
+static void free_run(Run *r) {
+    free(r->val);
+    free(r->cnt);
+}
+
+
+/**
+ * @brief Draws one Poisson bootstrap replicate of a run.
+ * @param w Receives the weight of each distinct value (r->k entries).
+ */
+static void resample(const Run *r, uint64_t *s, size_t *w, double *mean, double *median, double *p99) {
+    size_t total;
+    double sum;
+    do {
+        total = 0;
+        sum = 0;
+        for (size_t i = 0; i < r->k; ++i) {
+            w[i] = (size_t)poisson(s, (double)r->cnt[i]);
+            total += w[i];
+            sum += (double)r->val[i] * w[i];
+        }
+    } while (total == 0);
+    *mean = sum / total;
+    *median = (double)weighted_quantile(r->val, w, r->k, total, 0.5);
+    *p99 = (double)weighted_quantile(r->val, w, r->k, total, 0.99);
+}
+
+
+static void *bootstrap_worker(void *arg) {
+    BootJob *j = arg;
+    size_t *wa = malloc(j->base->k * sizeof(size_t));
+    size_t *wb = malloc(j->run->k * sizeof(size_t));
+    if (!wa || !wb) {
+        perror("malloc bootstrap");
+        free(wa); free(wb);
+        return (void *)1;
+    }
+    for (size_t rep = j->first; rep < j->last; ++rep) {
+        // One seed per replicate: the result does not depend on the thread split
+        uint64_t s = j->seed ^ (rep * 0xD1B54A32D192ED03ULL);
+        splitmix64(&s);
+        double ma, mda, pa, mb, mdb, pb;
+        resample(j->base, &s, wa, &ma, &mda, &pa);
+        resample(j->run, &s, wb, &mb, &mdb, &pb);
+        j->d_mean[rep] = mb - ma;
+        j->d_median[rep] = mdb - mda;
+        j->d_p99[rep] = pb - pa;
+    }
+    free(wa);
+    free(wb);
+    return NULL;
+}
+
+
+/**
+ * @brief Computes the bootstrap differences run - baseline, spread over threads.
+ * @return 0 on success, -1 on failure.
+ */
+static int bootstrap(const Run *base, const Run *run, size_t reps, int threads, uint64_t seed,
+                     double *d_mean, double *d_median, double *d_p99) {
+    pthread_t tid[MAX_THREADS];
+    BootJob job[MAX_THREADS];
+    int started = 0, ret = 0;
+    for (int t = 0; t < threads; ++t) {
+        job[t] = (BootJob){ base, run, reps * t / threads, reps * (t + 1) / threads, seed,
+                            d_mean, d_median, d_p99 };
+        if (pthread_create(&tid[t], NULL, bootstrap_worker, &job[t]) != 0) {
+            perror("pthread_create");
+            ret = -1;
+            break;
+        }
+        started++;
+    }
+    for (int t = 0; t < started; ++t) {
+        void *res;
+        pthread_join(tid[t], &res);
+        if (res) ret = -1;
+    }
+    return ret;
+}
+
+
+/**
+ * @brief Mann-Whitney U test of run against base, on the merged distinct values.
+ * @param z Receives the standardized statistic (positive: run is slower).
+ * @param p Receives the two-sided p-value.
+ * @param p_slower Receives P(run > base) + P(run = base) / 2.
+ */
+static void mann_whitney(const Run *base, const Run *run, double *u, double *z, double *p, double *p_slower) {
+    double na = (double)base->n, nb = (double)run->n, N = na + nb;
+    double rank_sum = 0, ties = 0, before = 0;
+    size_t i = 0, j = 0;
+    while (i < base->k || j < run->k) {
+        uint64_t v = (j >= run->k || (i < base->k && base->val[i] <= run->val[j])) ? base->val[i] : run->val[j];
+        double ca = (i < base->k && base->val[i] == v) ? (double)base->cnt[i++] : 0;
+        double cb = (j < run->k && run->val[j] == v) ? (double)run->cnt[j++] : 0;
+        double t = ca + cb;
+        rank_sum += cb * (before + (t + 1) / 2);
+        ties += t * t * t - t;
+        before += t;
+    }
+    *u = rank_sum - nb * (nb + 1) / 2;
+    *p_slower = *u / (na * nb);
+    double mu = na * nb / 2;
+    double sigma = sqrt(na * nb / 12 * ((N + 1) - ties / (N * (N - 1))));
+    if (sigma <= 0) {
+        *z = 0;
+        *p = 1;
+        return;
+    }
+    double d = *u - mu;
+    d = d > 0.5 ? d - 0.5 : (d < -0.5 ? d + 0.5 : 0);   // Continuity correction
+    *z = d / sigma;
+    *p = erfc(fabs(*z) / sqrt(2.0));
+}
+
+
+static const char *verdict(double lo, double hi, double diff_pct, double min_effect) {
+    if (lo <= 0 && hi >= 0) return "no difference";
+    if (fabs(diff_pct) < min_effect) return "negligible";
+    return lo > 0 ? "slower" : "faster";
+}
+
+
+/**
+ * @brief Prints the verdict line of one metric, in ms like iortest1.
+ * @param d The sorted bootstrap differences, in us.
+ */
+static void print_metric(const char *name, double a, double b, double *d, size_t reps, double alpha,
+                         double min_effect) {
+    qsort(d, reps, sizeof(double), cmp_double);
+    size_t lo_i = (size_t)(alpha / 2 * reps), hi_i = (size_t)((1 - alpha / 2) * reps);
+    if (hi_i >= reps) hi_i = reps - 1;
+    double lo = d[lo_i], hi = d[hi_i], pct = a > 0 ? 100.0 * (b - a) / a : 0.0;
+    printf("  %-8s %12.3f %12.3f %12.3f %12.3f %12.3f %+9.2f%%   %s\n", name, a / 1000.0, b / 1000.0,
+           (b - a) / 1000.0, lo / 1000.0, hi / 1000.0, pct, verdict(lo, hi, pct, min_effect));
+}
+
+
+int main(int argc, char **argv) {
+    const char *paths[argc];
+    int nb_runs = 0;
+    size_t reps = 2000;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = 1;
+    double alpha = 0.05, min_effect = 0.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bootstrap") && i + 1 < argc) reps = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--alpha") && i + 1 < argc) alpha = strtod(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--min-effect") && i + 1 < argc) min_effect = strtod(argv[++i], NULL);
+        else paths[nb_runs++] = argv[i];
+    }
+    if (nb_runs < 2 || reps < 100 || alpha <= 0 || alpha >= 1) {
+        fprintf(stderr, "Usage: %s [options] <baseline_latencies> <run_latencies> [<run_latencies>...]\n", argv[0]);
+        fprintf(stderr, "  Latency files are written by iortest1 --latency-log.\n");
+        fprintf(stderr, "  --bootstrap <N>    Bootstrap replicates, at least 100 (default: 2000)\n");
+        fprintf(stderr, "  --threads <N>      Resampling threads (default: online CPUs)\n");
+        fprintf(stderr, "  --seed <S>         Seed of the resampling (default: 1)\n");
+        fprintf(stderr, "  --alpha <A>        Significance level, Bonferroni-corrected over the runs (default: 0.05)\n");
+        fprintf(stderr, "  --min-effect <P>   Significant differences below P %% are reported as negligible (default: 0)\n");
+        return EXIT_FAILURE;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((size_t)threads > reps) threads = (int)reps;
+
+    Run runs[nb_runs];
+    for (int r = 0; r < nb_runs; ++r) {
+        if (load_run(&runs[r], paths[r]) < 0) {
+            for (int q = 0; q <= r; ++q) free_run(&runs[q]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    double alpha_c = alpha / (nb_runs - 1);
+    printf("Runs (latencies in ms):\n");
+    for (int r = 0; r < nb_runs; ++r)
+        printf("  %c %-40s n = %-10zu mean %.3f   median %.3f   p99 %.3f\n", 'A' + r, runs[r].path,
+               runs[r].n, runs[r].mean / 1000.0, runs[r].median / 1000.0, runs[r].p99 / 1000.0);
+    printf("Bootstrap: %zu Poisson replicates, %d thread(s), %.2f%% CI", reps, threads, 100 * (1 - alpha_c));
+    if (nb_runs > 2) printf(" (%.0f%% Bonferroni-corrected over %d comparisons)", 100 * (1 - alpha), nb_runs - 1);
+    printf("\n");
+
+    double *d = malloc(3 * reps * sizeof(double));
+    if (!d) {
+        perror("malloc bootstrap");
+        for (int r = 0; r < nb_runs; ++r) free_run(&runs[r]);
+        return EXIT_FAILURE;
+    }
+    int ret = EXIT_SUCCESS;
+    for (int r = 1; r < nb_runs; ++r) {
+        const Run *a = &runs[0], *b = &runs[r];
+        struct timeval t0, t1;
+        gettimeofday(&t0, NULL);
+        if (bootstrap(a, b, reps, threads, seed, d, d + reps, d + 2 * reps) < 0) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+        gettimeofday(&t1, NULL);
+
+        char name[2] = { (char)('A' + r), 0 }, diff[8], vname[16];
+        snprintf(diff, sizeof(diff), "%s - A", name);
+        snprintf(vname, sizeof(vname), "Verdict (%s)", name);
+        printf("\n%s vs A (%s vs %s), resampled in %.3f s\n", name, b->path, a->path,
+               (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+        printf("  %-8s %12s %12s %12s %12s %12s %10s   %s\n", "Metric", "A", name, diff, "CI low", "CI high",
+               "Change", vname);
+        print_metric("mean", a->mean, b->mean, d, reps, alpha_c, min_effect);
+        print_metric("median", (double)a->median, (double)b->median, d + reps, reps, alpha_c, min_effect);
+        print_metric("p99", (double)a->p99, (double)b->p99, d + 2 * reps, reps, alpha_c, min_effect);
+
+        double u, z, p, p_slower;
+        mann_whitney(a, b, &u, &z, &p, &p_slower);
+        printf("  Mann-Whitney U = %.0f   z = %.3f   p = %.3g   P(%s op slower than A op) = %.3f   Verdict: %s\n",
+               u, z, p, name, p_slower, p >= alpha_c ? "no difference" : (z > 0 ? "slower" : "faster"));
+    }
+
+    free(d);
+    for (int r = 0; r < nb_runs; ++r) free_run(&runs[r]);
+    return ret;
+}
@@ -0,0 +1,169 @@
+/**
+ * cpu_counters.c
+ *
+ * Per-thread CPU cost counters (see cpu_counters.h).
+ *
+ */
+
+#include "cpu_counters.h"
+#include <stdio.h>              // For perror.
+#include <string.h>             // For memset.
+#include <errno.h>              // For errno, to detect a paranoid kernel.
+#include <unistd.h>             // For syscall, read, close.
+#include <sys/ioctl.h>          // For ioctl, to enable the event group.
+#include <sys/syscall.h>        // For SYS_perf_event_open (no glibc wrapper).
+#include <sys/resource.h>       // For getrusage, the fallback backend.
+#include <linux/perf_event.h>   // For struct perf_event_attr and the event codes.
+
+
+static const char *counter_names[NB_CPU_COUNTERS] = {
+    "cycles", "instructions", "task-clock", "context-switches", "cpu-migrations"
+};
+
+static const struct { uint32_t type; uint64_t config; } counter_events[NB_CPU_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+
+/**
+ * @brief Returns the name of a counter, as perf stat prints it.
+ */
+const char *cpu_counter_name(int k) {
+    return (k >= 0 && k < NB_CPU_COUNTERS) ? counter_names[k] : "unknown";
+}
+
+
+/**
+ * @brief Opens one event of the calling thread, in the group of leader (-1 for a new group).
+ */
+static int open_event(int k, int leader, int exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[k].type;
+    attr.config = counter_events[k].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = (leader < 0);
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+
+/**
+ * @brief Opens the counters of the calling thread.
+ *
+ * task-clock leads the perf group, so that the software events still work
+ * when the hardware ones are missing. If the kernel refuses to count kernel
+ * time, the group is opened user-only and context switches (which happen in
+ * the kernel) are taken from getrusage instead.
+ *
+ * @param c The counters to open.
+ * @param force_rusage Use the getrusage backend even if perf events work.
+ * @return 0 on success, -1 if no counter at all is available.
+ */
+int cpu_counters_open(CpuCounters *c, int force_rusage) {
+    memset(c, 0, sizeof(*c));
+    for (int k = 0; k < NB_CPU_COUNTERS; ++k) c->fd[k] = -1;
+
+    if (!force_rusage) {
+        int leader = open_event(CPU_TASK_CLOCK, -1, 0);
+        if (leader < 0 && (errno == EACCES || errno == EPERM)) {
+            leader = open_event(CPU_TASK_CLOCK, -1, 1);
+            c->user_only = (leader >= 0);
+        }
+        if (leader >= 0) {
+            c->backend = CPU_BACKEND_PERF;
+            c->fd[CPU_TASK_CLOCK] = leader;
+            c->slot[CPU_TASK_CLOCK] = c->nb_events++;
+            c->available[CPU_TASK_CLOCK] = 1;
+            for (int k = 0; k < NB_CPU_COUNTERS; ++k) {
+                if (k == CPU_TASK_CLOCK) continue;
+                if (c->user_only && k == CPU_CTX_SWITCHES) {
+                    c->available[k] = 1;  // from getrusage, see cpu_counters_read
+                    continue;
+                }
+                if (c->user_only && k == CPU_MIGRATIONS) continue;
+                int fd = open_event(k, leader, c->user_only);
+                if (fd < 0) continue;
+                c->fd[k] = fd;
+                c->slot[k] = c->nb_events++;
+                c->available[k] = 1;
+            }
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            if (ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0) return 0;
+            perror("PERF_EVENT_IOC_ENABLE");
+            cpu_counters_close(c);
+            memset(c->available, 0, sizeof(c->available));
+        }
+    }
+
+    // getrusage fallback: CPU time and context switches only
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) < 0) {
+        perror("getrusage");
+        return -1;
+    }
+    c->backend = CPU_BACKEND_RUSAGE;
+    c->user_only = 0;
+    c->available[CPU_TASK_CLOCK] = 1;
+    c->available[CPU_CTX_SWITCHES] = 1;
+    return 0;
+}
+
+
+/**
+ * @brief Reads the cumulative counters of the calling thread.
+ * Counters that are not available read as 0.
+ * @return 0 on success, -1 on failure.
+ */
+int cpu_counters_read(const CpuCounters *c, CpuSample *s) {
+    memset(s, 0, sizeof(*s));
+    int need_rusage = (c->backend == CPU_BACKEND_RUSAGE) || c->user_only;
+
+    if (c->backend == CPU_BACKEND_PERF) {
+        uint64_t buf[1 + NB_CPU_COUNTERS];
+        if (read(c->fd[CPU_TASK_CLOCK], buf, sizeof(buf)) < (ssize_t)((1 + c->nb_events) * sizeof(uint64_t)))
+            return -1;
+        for (int k = 0; k < NB_CPU_COUNTERS; ++k)
+            if (c->fd[k] >= 0) s->v[k] = buf[1 + c->slot[k]];
+    }
+    if (need_rusage) {
+        struct rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) < 0) return -1;
+        if (c->backend == CPU_BACKEND_RUSAGE)
+            s->v[CPU_TASK_CLOCK] = ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000ULL
+                                 + ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000ULL;
+        s->v[CPU_CTX_SWITCHES] = (uint64_t)ru.ru_nvcsw + (uint64_t)ru.ru_nivcsw;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Computes after - before for every counter (0 if a counter went backwards).
+ */
+void cpu_sample_diff(const CpuSample *after, const CpuSample *before, CpuSample *out) {
+    for (int k = 0; k < NB_CPU_COUNTERS; ++k)
+        out->v[k] = after->v[k] > before->v[k] ? after->v[k] - before->v[k] : 0;
+}
+
+
+/**
+ * @brief Closes the perf events.
+ */
+void cpu_counters_close(CpuCounters *c) {
+    // Siblings first, the leader (task-clock) last
+    for (int k = 0; k < NB_CPU_COUNTERS; ++k) {
+        if (k == CPU_TASK_CLOCK || c->fd[k] < 0) continue;
+        close(c->fd[k]);
+        c->fd[k] = -1;
+    }
+    if (c->fd[CPU_TASK_CLOCK] >= 0) close(c->fd[CPU_TASK_CLOCK]);
+    c->fd[CPU_TASK_CLOCK] = -1;
+    c->nb_events = 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * cpu_counters.h
+ *
+ * CPU cost counters of the calling thread, read around each timed operation
+ * to split its latency into CPU work and device wait.
+ *
+ * The counters come from perf_event_open when the kernel allows it: cycles
+ * and instructions (hardware events, often missing in VMs), task-clock,
+ * context switches and CPU migrations (software events). Kernel time is
+ * counted unless perf_event_paranoid forbids it, in which case only the user
+ * part is seen. When perf events are not available at all, getrusage gives
+ * the CPU time and the context switches of the thread.
+ *
+ */
+
+#ifndef CPU_COUNTERS_H
+#define CPU_COUNTERS_H
+
+#include <stdint.h>     // For uint64_t.
+
+// Counters, in the order of CpuSample.v
+typedef enum {
+    CPU_CYCLES = 0,
+    CPU_INSTRUCTIONS,
+    CPU_TASK_CLOCK,      /* CPU time in nanoseconds */
+    CPU_CTX_SWITCHES,
+    CPU_MIGRATIONS,
+    NB_CPU_COUNTERS
+} CpuCounter;
+
+typedef enum {
+    CPU_BACKEND_PERF,
+    CPU_BACKEND_RUSAGE
+} CpuBackend;
+
+// One reading of the counters (cumulative values, or the difference of two readings)
+typedef struct {
+    uint64_t v[NB_CPU_COUNTERS];
+} CpuSample;
+
+typedef struct {
+    CpuBackend backend;
+    int available[NB_CPU_COUNTERS];  /* The counter is measured by the backend */
+    int slot[NB_CPU_COUNTERS];       /* perf backend: position in the group read */
+    int fd[NB_CPU_COUNTERS];         /* perf backend: event descriptors, -1 if not opened */
+    int nb_events;                   /* perf backend: events in the group */
+    int user_only;                   /* perf backend: kernel time is not counted */
+} CpuCounters;
+
+int cpu_counters_open(CpuCounters *c, int force_rusage);
+int cpu_counters_read(const CpuCounters *c, CpuSample *s);
+void cpu_counters_close(CpuCounters *c);
+void cpu_sample_diff(const CpuSample *after, const CpuSample *before, CpuSample *out);
+const char *cpu_counter_name(int k);
+
+#endif // CPU_COUNTERS_H
@@ -0,0 +1,254 @@
+/**
+ * extents.c
+ *
+ * Physical extent index of a file (see extents.h).
+ *
+ */
+
+#include "extents.h"
+#include <stdio.h>          // For perror, fprintf.
+#include <stdlib.h>         // For malloc, realloc, free, qsort.
+#include <string.h>         // For memset.
+#include <errno.h>          // For errno, to report filesystems without FIEMAP.
+#include <fcntl.h>          // For open.
+#include <unistd.h>         // For close.
+#include <sys/ioctl.h>      // For ioctl.
+#include <sys/stat.h>       // For fstat.
+#include <linux/fs.h>       // For FS_IOC_FIEMAP.
+#include <linux/fiemap.h>   // For struct fiemap and the FIEMAP_* flags.
+
+#define FIEMAP_BATCH 512    /* Extents fetched per ioctl */
+
+// Extents whose physical address is meaningless for seek distances
+#define EXTENT_NO_PHYSICAL (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL)
+
+
+/**
+ * @brief Loads the extent list of a file.
+ * FIEMAP_FLAG_SYNC flushes delayed allocations first, so that every written
+ * range has a physical address.
+ * @param m The map to fill.
+ * @param path The path of the file.
+ * @return 0 on success, -1 on failure (including filesystems without FIEMAP).
+ */
+int extent_map_load(ExtentMap *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open extent map");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat extent map");
+        close(fd);
+        return -1;
+    }
+    m->file_size = (uint64_t)st.st_size;
+
+    struct fiemap *fm = malloc(sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent));
+    if (!fm) {
+        perror("malloc fiemap");
+        close(fd);
+        return -1;
+    }
+    size_t capacity = 0;
+    uint64_t start = 0;
+    int last = 0;
+    while (!last && start < m->file_size) {
+        memset(fm, 0, sizeof(struct fiemap));
+        fm->fm_start = start;
+        fm->fm_length = FIEMAP_MAX_OFFSET - start;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = FIEMAP_BATCH;
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0) {
+            if (errno == EOPNOTSUPP || errno == ENOTTY)
+                fprintf(stderr, "Error: the filesystem of '%s' does not support FIEMAP.\n", path);
+            else
+                perror("ioctl FS_IOC_FIEMAP");
+            free(fm);
+            extent_map_free(m);
+            close(fd);
+            return -1;
+        }
+        if (fm->fm_mapped_extents == 0) break;
+
+        if (m->count + fm->fm_mapped_extents > capacity) {
+            capacity = (capacity ? capacity * 2 : FIEMAP_BATCH) + fm->fm_mapped_extents;
+            Extent *tmp = realloc(m->ext, capacity * sizeof(Extent));
+            if (!tmp) {
+                perror("realloc extents");
+                free(fm);
+                extent_map_free(m);
+                close(fd);
+                return -1;
+            }
+            m->ext = tmp;
+        }
+        for (unsigned i = 0; i < fm->fm_mapped_extents; ++i) {
+            const struct fiemap_extent *fe = &fm->fm_extents[i];
+            Extent *e = &m->ext[m->count++];
+            e->logical = fe->fe_logical;
+            e->physical = fe->fe_physical;
+            e->length = fe->fe_length;
+            e->flags = fe->fe_flags;
+            if (fe->fe_flags & FIEMAP_EXTENT_LAST) last = 1;
+        }
+        const Extent *e = &m->ext[m->count - 1];
+        start = e->logical + e->length;
+    }
+    free(fm);
+    close(fd);
+    return 0;
+}
+
+
+/**
+ * @brief Frees the extent list.
+ */
+void extent_map_free(ExtentMap *m) {
+    free(m->ext);
+    m->ext = NULL;
+    m->count = 0;
+}
+
+
+/**
+ * @brief Returns the index of the first extent ending after off (m->count if none).
+ */
+static size_t first_after(const ExtentMap *m, uint64_t off) {
+    size_t lo = 0, hi = m->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->ext[mid].logical + m->ext[mid].length <= off) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+/**
+ * @brief Returns the index of the extent holding offset off, or m->count if
+ * off falls in a hole.
+ */
+size_t extent_find(const ExtentMap *m, uint64_t off) {
+    size_t i = first_after(m, off);
+    return (i < m->count && m->ext[i].logical <= off) ? i : m->count;
+}
+
+
+/**
+ * @brief Maps a file offset to its physical address.
+ * @return 0 on success, -1 if the offset is not backed by a known block.
+ */
+int extent_physical(const ExtentMap *m, uint64_t off, uint64_t *phys) {
+    size_t i = extent_find(m, off);
+    if (i == m->count || (m->ext[i].flags & EXTENT_NO_PHYSICAL)) return -1;
+    *phys = m->ext[i].physical + (off - m->ext[i].logical);
+    return 0;
+}
+
+
+/**
+ * @brief Tells whether extent i + 1 continues extent i both in the file and on disk.
+ */
+static int contiguous(const ExtentMap *m, size_t i) {
+    const Extent *a = &m->ext[i], *b = &m->ext[i + 1];
+    return a->logical + a->length == b->logical && a->physical + a->length == b->physical;
+}
+
+
+/**
+ * @brief Counts the discontinuities of the mapping inside [off, off + len):
+ * boundaries between extents that are not physically contiguous, and the
+ * edges of holes. Contiguous extents (split by the filesystem's maximum
+ * extent length) do not count, the head does not move there.
+ */
+size_t extent_crossings(const ExtentMap *m, uint64_t off, uint64_t len) {
+    uint64_t end = off + len;
+    size_t n = 0, i = first_after(m, off);
+    if (i < m->count && m->ext[i].logical > off && m->ext[i].logical < end) n++;  // starts in a hole
+    for (; i < m->count && m->ext[i].logical + m->ext[i].length < end; ++i)
+        if (i + 1 == m->count || !contiguous(m, i)) n++;
+    return n;
+}
+
+
+/**
+ * @brief Maps a request and computes the logical and physical distances
+ * from the end of the previous mapped request to its start (0 for the
+ * first one).
+ * @param m The extent map.
+ * @param c The head position, updated when the request is mapped.
+ * @param off The offset of the request.
+ * @param len The length of the request.
+ * @param phys Receives the physical address of the start of the request.
+ * @param lseek Receives the logical seek distance in bytes.
+ * @param pseek Receives the physical seek distance in bytes.
+ * @param crossings Receives the discontinuities crossed by the request.
+ * @return 0 on success, -1 if the start of the request is not mapped (the
+ * cursor is left unchanged and only crossings is set).
+ */
+int extent_request(const ExtentMap *m, ExtentCursor *c, uint64_t off, uint64_t len,
+                   uint64_t *phys, uint64_t *lseek, uint64_t *pseek, size_t *crossings) {
+    *crossings = len > 0 ? extent_crossings(m, off, len) : 0;
+    if (extent_physical(m, off, phys) < 0) return -1;
+    *lseek = !c->valid ? 0 : (off > c->end ? off - c->end : c->end - off);
+    *pseek = !c->valid ? 0 : (*phys > c->head ? *phys - c->head : c->head - *phys);
+
+    uint64_t last;
+    if (len > 0 && extent_physical(m, off + len - 1, &last) == 0) c->head = last + 1;
+    else c->head = *phys + len;
+    c->end = off + len;
+    c->valid = 1;
+    return 0;
+}
+
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Summarizes the fragmentation of the file.
+ */
+void extent_summary(const ExtentMap *m, ExtentSummary *s) {
+    memset(s, 0, sizeof(*s));
+    s->extents = m->count;
+    if (m->count == 0) {
+        s->holes = m->file_size > 0;
+        return;
+    }
+
+    // Fragment sizes: runs of extents contiguous in the file and on disk
+    uint64_t *frag = malloc(m->count * sizeof(uint64_t));
+    uint64_t lo = UINT64_MAX, hi = 0, run = 0;
+    if (m->ext[0].logical > 0) s->holes++;
+    for (size_t i = 0; i < m->count; ++i) {
+        const Extent *e = &m->ext[i];
+        s->mapped_bytes += e->length;
+        if (e->flags & FIEMAP_EXTENT_UNWRITTEN) s->unwritten++;
+        if (e->physical < lo) lo = e->physical;
+        if (e->physical + e->length > hi) hi = e->physical + e->length;
+        run += e->length;
+        if (i + 1 < m->count && e->logical + e->length < m->ext[i + 1].logical) s->holes++;
+        if (i + 1 == m->count || !contiguous(m, i)) {
+            if (frag) frag[s->fragments] = run;
+            s->fragments++;
+            if (run > s->largest) s->largest = run;
+            run = 0;
+        }
+    }
+    const Extent *e = &m->ext[m->count - 1];
+    if (e->logical + e->length < m->file_size) s->holes++;
+    s->span = hi - lo;
+    // The last extent is rounded up to a whole block
+    if (s->mapped_bytes > m->file_size) s->mapped_bytes = m->file_size;
+    if (frag) {
+        qsort(frag, s->fragments, sizeof(uint64_t), compare_u64);
+        s->median = frag[s->fragments / 2];
+        free(frag);
+    }
+}
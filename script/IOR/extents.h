@@ -0,0 +1,63 @@
+/**
+ * extents.h
+ *
+ * Physical layout of a file, read with the FS_IOC_FIEMAP ioctl.
+ *
+ * The extent list is loaded once and kept sorted by logical offset, so that
+ * mapping a file offset to its physical address is a binary search. It is
+ * used to turn logical seek distances into physical ones (the distance the
+ * disk head really travels on a fragmented file) and to count the extent
+ * boundaries a request crosses. Both distances go from the end of the
+ * previous request to the start of the next one, so a sequential run
+ * seeks 0 bytes on both sides.
+ *
+ */
+
+#ifndef EXTENTS_H
+#define EXTENTS_H
+
+#include <stddef.h>     // For size_t.
+#include <stdint.h>     // For uint64_t.
+
+typedef struct {
+    uint64_t logical;    /* Offset in the file, in bytes */
+    uint64_t physical;   /* Address on the device, in bytes */
+    uint64_t length;     /* Length in bytes */
+    uint32_t flags;      /* FIEMAP_EXTENT_* flags */
+} Extent;
+
+typedef struct {
+    Extent  *ext;        /* Extents sorted by logical offset */
+    size_t   count;
+    uint64_t file_size;
+} ExtentMap;
+
+// Fragmentation of a file
+typedef struct {
+    size_t   extents;         /* Extents reported by FIEMAP */
+    size_t   fragments;       /* Runs of physically contiguous extents */
+    size_t   holes;           /* Unmapped ranges inside the file */
+    size_t   unwritten;       /* Preallocated extents not written yet */
+    uint64_t mapped_bytes;    /* Bytes backed by an extent */
+    uint64_t largest;         /* Largest fragment, in bytes */
+    uint64_t median;          /* Median fragment size, in bytes */
+    uint64_t span;            /* Distance between the lowest and highest physical address */
+} ExtentSummary;
+
+// Position after the previous request
+typedef struct {
+    uint64_t head;            /* Physical address following the last mapped request */
+    uint64_t end;             /* Logical offset following the last mapped request */
+    int      valid;           /* head and end are set */
+} ExtentCursor;
+
+int extent_map_load(ExtentMap *m, const char *path);
+void extent_map_free(ExtentMap *m);
+size_t extent_find(const ExtentMap *m, uint64_t off);
+int extent_physical(const ExtentMap *m, uint64_t off, uint64_t *phys);
+size_t extent_crossings(const ExtentMap *m, uint64_t off, uint64_t len);
+int extent_request(const ExtentMap *m, ExtentCursor *c, uint64_t off, uint64_t len,
+                   uint64_t *phys, uint64_t *lseek, uint64_t *pseek, size_t *crossings);
+void extent_summary(const ExtentMap *m, ExtentSummary *s);
+
+#endif // EXTENTS_H
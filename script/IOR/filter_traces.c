@@ -2,6 +2,22 @@
 #include <stdlib.h> // Pour malloc, free, atoi, atol
 #include <string.h> // Pour strstr, sscanf, strcmp
 
+// Codes d'opération du format filtré (voir trace.h)
+#define OP_READ      0
+#define OP_WRITE     1
+#define OP_OPEN      2
+#define OP_CREATE    3
+#define OP_CLOSE     4
+#define OP_FSYNC     5
+#define OP_FDATASYNC 6
+#define OP_UNLINK    7
+
+// Colonne longueur d'un open/create : l'appel tracé avait O_TRUNC
+#define OPEN_TRUNC   1
+
+#define MAX_FD       4096
+#define PATH_TABLE   65536  // Taille de la table de hachage des chemins (puissance de deux)
+
 // Structure pour stocker les informations d'une opération d'E/S (non utilisée directement mais bonne pratique)
 typedef struct {
     char type[10];          // "read" ou "write"
@@ -12,13 +28,67 @@ typedef struct {
     long bytes_transferred; // Octets réellement transférés
 } IoOperation;
 
+// Table des chemins rencontrés (mode --metadata) : chaque chemin reçoit un identifiant
+// de fichier, 1, 2, ... dans l'ordre d'apparition ; le chemin --data-path reçoit 0.
+static char *path_keys[PATH_TABLE];
+static int path_ids[PATH_TABLE];
+static int next_file_id = 1;
+static const char *data_path = NULL;
+static const char *path_prefix = NULL;
+
+// Retourne l'identifiant de fichier d'un chemin, ou -1 si le chemin n'est pas rejoué
+// (pipe, socket, pseudo-fichier, ou hors de --path-prefix).
+static int path_id(const char *path) {
+    if (path[0] != '/') return -1;
+    if (path_prefix && strncmp(path, path_prefix, strlen(path_prefix)) != 0) return -1;
+    if (!path_prefix && (!strncmp(path, "/proc/", 6) || !strncmp(path, "/sys/", 5) || !strncmp(path, "/dev/", 5)))
+        return -1;
+
+    unsigned long h = 5381;
+    for (const char *c = path; *c; c++) h = h * 33 + (unsigned char)*c;
+    for (unsigned long i = h & (PATH_TABLE - 1); ; i = (i + 1) & (PATH_TABLE - 1)) {
+        if (path_keys[i] == NULL) {
+            if (next_file_id >= PATH_TABLE / 2) return -1; // table pleine
+            path_keys[i] = strdup(path);
+            path_ids[i] = (data_path && strcmp(path, data_path) == 0) ? 0 : next_file_id++;
+            return path_ids[i];
+        }
+        if (strcmp(path_keys[i], path) == 0) return path_ids[i];
+    }
+}
+
+// Extrait le chemin d'un descripteur annoté par strace -yy ("3</chemin>") après la chaîne s.
+static int annotated_path(const char *s, char *out, size_t out_len) {
+    const char *lt = strchr(s, '<');
+    if (!lt) return 0;
+    const char *gt = strchr(lt + 1, '>');
+    if (!gt || (size_t)(gt - lt - 1) >= out_len) return 0;
+    memcpy(out, lt + 1, gt - lt - 1);
+    out[gt - lt - 1] = '\0';
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <trace_file.log>\n", argv[0]);
+    // --aligned-only conserve l'ancien filtre (requêtes de 512 octets alignées sur 512),
+    // utile pour un rejeu avec le moteur syscall qui ne supporte que l'E/S alignée.
+    // --metadata ajoute les opérations open/creat/close/fsync/fdatasync/unlink et une
+    // quatrième colonne (identifiant de fichier) ; --data-path désigne le fichier de la
+    // trace rejoué sur --data-file, --path-prefix restreint les fichiers retenus.
+    int aligned_only = 0, metadata = 0;
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--aligned-only") == 0) aligned_only = 1;
+        else if (strcmp(argv[i], "--metadata") == 0) metadata = 1;
+        else if (strcmp(argv[i], "--data-path") == 0 && i + 1 < argc) data_path = argv[++i];
+        else if (strcmp(argv[i], "--path-prefix") == 0 && i + 1 < argc) path_prefix = argv[++i];
+        else trace_path = argv[i];
+    }
+    if (trace_path == NULL) {
+        fprintf(stderr, "Usage: %s [--aligned-only] [--metadata [--data-path <path>] [--path-prefix <prefix>]] <trace_file.log>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    FILE *file = fopen(argv[1], "r");
+    FILE *file = fopen(trace_path, "r");
     if (file == NULL) {
         perror("Impossible d'ouvrir le fichier de trace");
         return EXIT_FAILURE;
@@ -30,9 +100,9 @@ int main(int argc, char *argv[]) {
 
     // Tableau pour stocker l'offset courant par descripteur de fichier.
     // Ajustez la taille si vous vous attendez à des descripteurs de fichiers > 4095.
-    long current_offsets[4096] = {0};
+    long current_offsets[MAX_FD] = {0};
     // Flag pour savoir si l'offset d'un FD a été initialisé via lseek ou open.
-    int fd_initialized[4096] = {0};
+    int fd_initialized[MAX_FD] = {0};
 
     // En-tête mis à jour pour utiliser des espaces
     printf("Nature_operation Offset Taille_requete\n");
@@ -43,29 +113,87 @@ int main(int argc, char *argv[]) {
         long fd_num;
         char path_buffer[256] = "";
 
+        // Ignorer le préfixe "[pid N] " ajouté par strace -f
+        const char *call = line;
+        if (strncmp(line, "[pid", 4) == 0) {
+            const char *bracket = strchr(line, ']');
+            if (bracket) call = bracket + 2;
+        }
+
         // Tenter d'analyser les lignes lseek pour mettre à jour les offsets
         long lseek_offset_arg, lseek_result;
         char whence_str[10];
         
         // Regex pour lseek. Exemple: lseek(16<...>, 101429760, SEEK_SET) = 101429760
-        if (sscanf(line, "[pid %*d] lseek(%ld<%255[^>]>, %ld, %9[^)]) = %ld", 
+        if (sscanf(call, "lseek(%ld<%255[^>]>, %ld, %9[^)]) = %ld", 
                    &fd_num, path_buffer, &lseek_offset_arg, whence_str, &lseek_result) == 5) {
             
-            if (fd_num >= 0 && fd_num < 4096) {
+            if (fd_num >= 0 && fd_num < MAX_FD) {
                 current_offsets[fd_num] = lseek_result;
                 fd_initialized[fd_num] = 1;
             }
             continue; // Passer à la ligne suivante
         }
+
+        // Opérations de métadonnées. Exemples :
+        //   openat(AT_FDCWD</home>, "f", O_RDWR|O_CREAT, 0644) = 3</home/f>
+        //   close(3</home/f>) = 0      fsync(3</home/f>) = 0      unlink("/home/f") = 0
+        char name[16];
+        const char *ret_str = strstr(call, ") = ");
+        if (ret_str && sscanf(call, "%15[a-z](", name) == 1) {
+            long ret = strtol(ret_str + 4, NULL, 10);
+            int is_open = !strcmp(name, "open") || !strcmp(name, "openat") || !strcmp(name, "creat");
+            int is_fdop = !strcmp(name, "close") || !strcmp(name, "fsync") || !strcmp(name, "fdatasync");
+            int is_unlink = !strcmp(name, "unlink") || !strcmp(name, "unlinkat");
+
+            if (is_open && ret >= 0) {
+                // Un nouveau descripteur commence à l'offset 0
+                if (ret < MAX_FD) {
+                    current_offsets[ret] = 0;
+                    fd_initialized[ret] = 1;
+                }
+                if (metadata && annotated_path(ret_str + 4, path_buffer, sizeof(path_buffer))) {
+                    int id = path_id(path_buffer);
+                    // creat() équivaut à O_CREAT|O_WRONLY|O_TRUNC
+                    const char *creat_flag = strstr(call, "O_CREAT"), *trunc_flag = strstr(call, "O_TRUNC");
+                    int created = !strcmp(name, "creat") || (creat_flag && creat_flag < ret_str);
+                    int truncated = !strcmp(name, "creat") || (trunc_flag && trunc_flag < ret_str);
+                    if (id >= 0) printf("%d 0 %d %d\n", created ? OP_CREATE : OP_OPEN, truncated ? OPEN_TRUNC : 0, id);
+                }
+                continue;
+            }
+            if (is_fdop) {
+                if (metadata && ret == 0 && sscanf(call + strlen(name) + 1, "%ld<%255[^>]>", &fd_num, path_buffer) == 2) {
+                    int id = path_id(path_buffer);
+                    int op = !strcmp(name, "close") ? OP_CLOSE : !strcmp(name, "fsync") ? OP_FSYNC : OP_FDATASYNC;
+                    if (id >= 0) printf("%d 0 0 %d\n", op, id);
+                }
+                continue;
+            }
+            if (is_unlink) {
+                // unlinkat : le chemin relatif est résolu par rapport au répertoire annoté
+                char rel[256], full[512];
+                const char *quote = strchr(call, '"');
+                if (metadata && ret == 0 && quote && sscanf(quote, "\"%255[^\"]\"", rel) == 1) {
+                    if (rel[0] != '/' && !strcmp(name, "unlinkat") && annotated_path(call, path_buffer, sizeof(path_buffer)))
+                        snprintf(full, sizeof(full), "%s/%s", path_buffer, rel);
+                    else
+                        snprintf(full, sizeof(full), "%s", rel);
+                    int id = path_id(full);
+                    if (id >= 0) printf("%d 0 0 %d\n", OP_UNLINK, id);
+                }
+                continue;
+            }
+        }
         
         // Tenter d'analyser les lignes read/write
         long size_req, bytes_trans;
         
         // Regex pour read/write. Exemple: read(16<...>, "...", 512) = 512
-        if (sscanf(line, "[pid %*d] %9[a-z](%ld<%255[^>]>, %*[^,], %ld) = %ld", 
+        if (sscanf(call, "%9[a-z](%ld<%255[^>]>, %*[^,], %ld) = %ld", 
                    op_type, &fd_num, path_buffer, &size_req, &bytes_trans) == 5) {
 
-            if (fd_num >= 0 && fd_num < 4096 && (strcmp(op_type, "read") == 0 || strcmp(op_type, "write") == 0)) {
+            if (fd_num >= 0 && fd_num < MAX_FD && (strcmp(op_type, "read") == 0 || strcmp(op_type, "write") == 0)) {
                 
                 // Initialiser l'offset à 0 si c'est la première E/S sur ce FD et qu'aucun lseek n'a été vu
                 if (!fd_initialized[fd_num]) {
@@ -73,19 +201,26 @@ int main(int argc, char *argv[]) {
                     fd_initialized[fd_num] = 1;
                 }
 
-                // On vérifie si la taille de la requête est exactement 512 ET
-                // que l'offset courant est un multiple de 512.
-                if (size_req == 512 && (current_offsets[fd_num] % 512 == 0)) {
+                // Toutes les requêtes sont conservées : le moteur bounce du rejeu
+                // gère les tailles et offsets non alignés. Avec --aligned-only, on
+                // vérifie que la taille est exactement 512 ET que l'offset est un multiple de 512.
+                int keep = aligned_only ? (size_req == 512 && (current_offsets[fd_num] % 512 == 0))
+                                        : (size_req > 0);
+                // En mode --metadata, seuls les fichiers retenus par path_id() sont rejoués
+                int file_id = metadata ? path_id(path_buffer) : 0;
+                if (keep && file_id >= 0 && metadata) {
+                    printf("%d %ld %ld %d\n", (strcmp(op_type, "write") == 0) ? OP_WRITE : OP_READ,
+                           current_offsets[fd_num], size_req, file_id);
+                } else if (keep && file_id >= 0) {
                     // Nature de l'opération (binaire) : 0 pour read (Entrée), 1 pour write (Sortie)
                     int binary_op_type = (strcmp(op_type, "write") == 0) ? 1 : 0;
                     
-                    // *** CORRECTION ICI ***
-                    // On utilise %d pour la taille, car le programme de rejeu la lit comme un entier.
-                    // Les valeurs sont maintenant séparées par un espace.
-                    printf("%d %ld %d\n", 
+                    // La taille n'est plus limitée à 512 octets ; le programme de rejeu la lit comme un int.
+                    // Les valeurs sont séparées par un espace.
+                    printf("%d %ld %ld\n", 
                            binary_op_type, 
                            current_offsets[fd_num], 
-                           (int)size_req);
+                           size_req);
                 }
 
                 // Mettre à jour l'offset pour la prochaine opération, que la requête ait été affichée ou non.
@@ -4,14 +4,57 @@
  * Replays an I/O trace, timing the raw read/write operation.
  * The lseek time is not included in the final measurement.
  *
+ * Two engines are available (--engine):
+ *  - syscall: read/write on an O_SYNC | O_DIRECT descriptor (default).
+ *  - mmap:    loads/stores on a shared mapping of the data file, with
+ *             page-fault accounting through getrusage.
+ *  - bounce:  O_DIRECT like syscall, but requests that are not aligned on
+ *             --align are expanded to aligned device I/O through a pool of
+ *             aligned bounce buffers (read-modify-write for partial writes).
+ *
+ * Besides reads and writes, traces may hold metadata and durability ops
+ * (open, create, close, fsync, fdatasync, unlink). Files other than the
+ * data file live in a scratch directory; their lifecycle follows the trace
+ * and whatever is left is removed at the end. Latencies are kept in one
+ * histogram per op type.
+ *
+ * Writes take their payload from a pool of pre-generated buffers whose
+ * content is set by --write-pattern (random, compressible, zero, fill), so
+ * that compressing or deduplicating SSDs see realistic data.
+ *
+ * With --cpu-counters, CPU counters (perf_event_open, or getrusage as a
+ * fallback) are read around each timed op, to split its latency into CPU
+ * work and device wait.
+ *
+ * The page-cache residency of the data file (--cache-check) is sampled
+ * before and after the replay, and optionally every --cache-interval ops
+ * and before each read, to verify that a cold-cache run really is cold.
+ *
+ * With --extents, the extent list of the data file (FS_IOC_FIEMAP) maps
+ * each request to its physical address, to report physical seek distances,
+ * extent crossings and the fragmentation of the file.
+ *
+ * With --stream, the trace is not loaded up front: a loader thread parses it
+ * in chunks while the replay runs, latencies only go to the histograms, and
+ * memory stays bounded by --stream-window whatever the trace length.
+ *
+ * --latency-log writes the latency of every executed read and write, one
+ * value in microseconds per line, for the statistical comparison of runs
+ * (compare_runs.c). Metadata ops are left out, so that runs compare the same
+ * kind of ops whatever the metadata density of the trace.
+ *
  */
 
 // Include necessary headers
 #include "tools.h"      // Contains utility structures and functions like AppConfig, ReplayStats, parse_args, calculate_stats.
+#include "trace.h"      // Contains the IOReq structure and load_trace.
+#include "cpu_counters.h" // Per-thread CPU counters read around the timed ops.
+#include "page_cache.h"   // Page-cache residency of the data file (mincore, cachestat).
+#include "extents.h"      // Physical extent index of the data file (FIEMAP).
 #include <time.h>       // For clock_gettime, used for precise time measurements (although gettimeofday is used here).
 #include <errno.h>      // For system error handling (perror).
 #include <string.h>     // For string and memory manipulation functions (memset, memcpy).
-#include <sys/mman.h>   // For the mmap function, used to map the trace file into memory.
+#include <sys/mman.h>   // For the mmap function, used to map the data file into memory (mmap engine).
 #include <sys/stat.h>   // For fstat, which gets file information.
 #include <fcntl.h>      // For open and file flags (O_RDONLY, O_WRONLY, O_DIRECT, etc.).
 #include <unistd.h>     // For close, lseek64, read, write, sync.
@@ -21,135 +64,291 @@
 #include <math.h>       // For mathematical functions (llabs for absolute value, sqrt for square root, pow for powers).
 #include <inttypes.h>   // For printf formatting macros (PRIu64).
 #include <sys/time.h>   // For gettimeofday, a high-resolution timing method.
+#include <sys/resource.h> // For getrusage, used to count page faults in the mmap engine.
+#include <libgen.h>     // For dirname, used to place the scratch directory.
 
-#define SECTOR_SIZE 512
+#define MIN_IO_ALIGN 512                 /* Smallest O_DIRECT alignment (logical sector) */
 #define TARGET_MEM_BYTES (1024 * 1024) /* 1 MiB target per memory measurement */
+#define COMPRESS_CHUNK 4096              /* Unit on which --compress-ratio is applied */
+#define HIST_SUB_BUCKETS 16              /* Sub-buckets per power of two in log-linear histograms */
+#define NB_HIST_BUCKETS (HIST_SUB_BUCKETS + 60 * HIST_SUB_BUCKETS)
+
+// Log-linear histogram (about 6% relative precision). Unit-neutral: it holds
+// latencies in microseconds (hist) or seek distances in bytes (seek_*)
+typedef struct {
+    size_t count[NB_HIST_BUCKETS];
+    size_t n;        /* Number of recorded values */
+    size_t sum;      /* Sum of the recorded values */
+    size_t max;      /* Largest recorded value */
+} LogHist;
+
+// A file of the trace, as seen by the replay
+typedef struct {
+    char *path;      /* Data file for id 0, scratch file otherwise */
+    int   fd;        /* Open descriptor, -1 if closed */
+    int   refs;      /* Number of trace-level opens not yet closed */
+    int   seen;      /* The trace already created, opened or unlinked the file */
+    int   exists;    /* The file currently exists on disk (scratch files) */
+} FileSlot;
+
+// Per-run state of the replay engine
+typedef struct {
+    FileSlot *files;         /* Files of the trace, indexed by file id */
+    size_t nb_files;         /* Number of slots in files */
+    int    scratch_created;  /* The scratch directory was created by the replay */
+    int    scratch_ready;    /* The scratch directory exists (made on first use), -1 if it cannot be made */
+    size_t implicit_opens;   /* Untimed opens done for ops on a file the trace did not open */
+    size_t materialized;     /* Scratch files the trace opened without creating them */
+    size_t skipped_ops;      /* Ops not replayed (unsupported by the engine, unlink of the data file) */
+    size_t skipped_files;    /* mmap engine: ops skipped because they target another file than the data file */
+    int    aborted;          /* The replay stopped on an error before the end of the trace */
+    LogHist hist[NB_OP_TYPES]; /* Latency histogram per op type (us) */
+    char  *map;              /* mmap engine: shared mapping of the data file */
+    size_t map_len;          /* mmap engine: length of the mapping in bytes */
+    size_t minor_faults;     /* mmap engine: minor faults taken by the timed accesses */
+    size_t major_faults;     /* mmap engine: major faults taken by the timed accesses */
+    size_t major_fault_ops;  /* mmap engine: accesses that took at least one major fault */
+    size_t major_fault_us;   /* mmap engine: cumulated latency of those accesses */
+    char **bounce;           /* bounce engine: pool of aligned bounce buffers */
+    size_t bounce_len;       /* bounce engine: size of each pool buffer */
+    size_t bounce_next;      /* bounce engine: next buffer to hand out */
+    size_t req_bytes;        /* Bytes requested by the trace */
+    size_t dev_bytes;        /* Bytes actually transferred to/from the device */
+    size_t req_ops;          /* Requests executed */
+    size_t dev_ops;          /* Device operations issued for them */
+    size_t unaligned_ops;    /* bounce engine: requests that went through a bounce buffer */
+    size_t rmw_ops;          /* bounce engine: writes that needed a read-modify-write */
+    size_t failed_ops;       /* Requests that returned an error, left out of the latency statistics */
+    size_t data_ops;         /* Reads and writes executed, i.e. entries of the latency and seek arrays */
+    double lat_sq_us;        /* Sum of the squared read/write latencies, for the CI of streamed replays */
+    size_t buffer_growths;   /* Streamed replays: times the I/O buffers had to grow */
+    int    cpu_on;           /* --cpu-counters: counters are read around the timed ops */
+    CpuCounters cpu;         /* The counters of the replay thread */
+    CpuSample cpu_before;    /* Counters read just before the timed region */
+    CpuSample cpu_op;        /* Counters of the last timed op, baseline removed */
+    CpuSample cpu_baseline;  /* Cost of reading the counters, removed from each op */
+    CpuSample cpu_sum[NB_OP_TYPES]; /* Counters summed per op type */
+    uint64_t op_wall_start;  /* CLOCK_MONOTONIC at the start of the timed op (ns) */
+    uint64_t op_wall_ns;     /* Wall-clock time of the last timed op, same window as cpu_op (ns) */
+    uint64_t wall_sum_ns[NB_OP_TYPES]; /* op_wall_ns summed per op type */
+    CpuSample cpu_run;       /* Counters of the whole replay loop */
+    size_t run_us;           /* Wall-clock time of the replay loop */
+    int    cache_on;         /* --cache-check: the residency of the data file is probed */
+    PageCacheProbe cache;    /* Residency probe of the data file */
+    PageCacheState cache_start; /* Residency when the first op runs */
+    PageCacheState cache_end;   /* Residency after the last op */
+    size_t cache_probe_ops;  /* --cache-check op: reads of the data file probed */
+    size_t cache_hit_ops;    /* Probed reads whose pages were all resident */
+    size_t cache_probe_pages;/* Pages covered by the probed reads */
+    size_t cache_hit_pages;  /* Of those, pages resident just before the read */
+    int    extents_on;       /* --extents: requests are mapped to physical addresses */
+    ExtentMap extents;       /* Extent index of the data file, loaded before the replay */
+    ExtentSummary extent_summary; /* Fragmentation of the data file before the replay */
+    uint64_t data_size;      /* Size of the data file before the replay */
+    ExtentCursor extent_cursor; /* Physical head position after the last mapped request */
+    FILE  *lat_log;          /* --latency-log of a streamed replay: read/write latencies written as they come */
+    LogHist seek_logical;    /* Logical seek distances of the mapped requests (bytes) */
+    LogHist seek_physical;   /* Physical seek distances of the same requests (bytes) */
+    size_t crossings;        /* Extent discontinuities crossed by the requests */
+    size_t crossing_ops;     /* Requests crossing at least one discontinuity */
+    size_t unmapped_ops;     /* Requests starting in a hole of the data file */
+} ReplayCtx;
 
-// Structure representing a single I/O request
+// Pool of pre-generated write payloads
 typedef struct {
-    short op_type;       /* 0 for a read, 1 for a write */
-    long  offset;        /* The offset in bytes from the start of the file */
-    short length;        /* The length of the operation in bytes */
-} IOReq;
+    char  **bufs;    /* Aligned write buffers */
+    size_t  count;   /* Number of buffers */
+    size_t  len;     /* Size of each buffer */
+    size_t  next;    /* Next buffer in rotate mode */
+    size_t  seq;     /* Number of payloads handed out */
+} WritePool;
 
 static AppConfig config;
 
 
 /**
- * @brief Loads an I/O trace from a file and stores it in an array.
- * @param path The path to the trace file.
- * @param reqs A pointer to a pointer of IOReq to store the array of requests.
- * @return The number of requests loaded, or 0 on error.
+ * @brief Prepares a memory-aligned I/O buffer for O_DIRECT operations.
+ * @param reqs The array of I/O requests to determine the maximum length.
+ * @param nreq The number of requests.
+ * @param out_max_len A pointer to store the maximum buffer size.
+ * @return A pointer to the allocated I/O buffer, or NULL on failure.
  */
-static size_t load_trace(const char *path, IOReq **reqs) {
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        perror("open trace");
-        return 0;
-    }
+static char *prepare_io_buffer(IOReq *reqs, size_t nreq, size_t *out_max_len) {
+    *out_max_len = 0;
+    for (size_t i = 0; i < nreq; ++i)
+        if ((size_t)reqs[i].length > *out_max_len)
+            *out_max_len = reqs[i].length;
+    if (*out_max_len == 0) *out_max_len = MIN_IO_ALIGN;
+    // Round up so that O_DIRECT transfers of the whole buffer stay valid
+    size_t align = config.align > MIN_IO_ALIGN ? config.align : MIN_IO_ALIGN;
+    *out_max_len = (*out_max_len + align - 1) / align * align;
 
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        perror("fstat");
-        close(fd);
-        return 0;
-    }
-    size_t filesize = (size_t)st.st_size;
-    if (filesize == 0) {
-        close(fd);
-        return 0;
+    char *buf = NULL;
+    // Allocate memory aligned to the sector size
+    if (posix_memalign((void**)&buf, align, *out_max_len) != 0) {
+        perror("posix_memalign");
+        return NULL;
     }
+    // Fill the buffer with some data
+    memset(buf, 'B', *out_max_len);
+    return buf;
+}
 
-    // Map the file into memory for fast reading
-    char *data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    if (data == MAP_FAILED) {
-        perror("mmap");
-        return 0;
+
+/**
+ * @brief xorshift64* step, used to generate the write payloads.
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * @brief Fills a buffer with pseudo-random bytes.
+ */
+static void fill_random(char *dst, size_t len, uint64_t *state) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t v = next_random(state);
+        memcpy(dst + i, &v, sizeof(v));
     }
+    for (; i < len; ++i) dst[i] = (char)next_random(state);
+}
 
-    // Skip the first two header lines of the trace file
-    char *ptr = data;
-    char *end = data + filesize;
-    char *nl = memchr(ptr, '\n', end - ptr);
-    if (nl) ptr = nl + 1;
-    nl = memchr(ptr, '\n', end - ptr);
-    if (nl) ptr = nl + 1;
-
-    // Allocate memory for the requests with an initial capacity
-    size_t capacity = ((end - ptr) / 8) + 8;
-    IOReq *array = malloc(capacity * sizeof(IOReq));
-    if (!array) {
-        perror("malloc reqs");
-        munmap(data, filesize);
-        return 0;
+
+/**
+ * @brief Builds the pool of write payloads. Called before the replay, outside
+ * of the timed region.
+ *
+ * random:       incompressible pseudo-random bytes.
+ * compressible: each COMPRESS_CHUNK bytes start with chunk / --compress-ratio
+ *               random bytes followed by zeros, so a block compressor reaches
+ *               about the requested ratio.
+ * zero:         all-zero buffers.
+ * fill:         'B' bytes, as the replay used to write.
+ *
+ * @param pool The pool to initialize.
+ * @param len The size of each buffer (the I/O buffer size).
+ * @return 0 on success, -1 on failure.
+ */
+static int write_pool_init(WritePool *pool, size_t len) {
+    memset(pool, 0, sizeof(*pool));
+    pool->bufs = calloc(config.write_pool, sizeof(char *));
+    if (!pool->bufs) {
+        perror("calloc write pool");
+        return -1;
     }
+    pool->count = config.write_pool;
+    pool->len = len;
 
-    // Read each line of the trace and parse it into an IOReq structure
-    size_t count = 0;
-    while (ptr < end) {
-        if (count >= capacity) {
-            capacity *= 2;
-            IOReq *tmp = realloc(array, capacity * sizeof(IOReq));
-            if (!tmp) {
-                perror("realloc");
-                free(array);
-                munmap(data, filesize);
-                return 0;
-            }
-            array = tmp;
+    size_t align = config.align > MIN_IO_ALIGN ? config.align : MIN_IO_ALIGN;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < pool->count; ++i) {
+        if (posix_memalign((void**)&pool->bufs[i], align, len) != 0) {
+            perror("posix_memalign write pool");
+            return -1;
         }
-
-        short t; long off; short len;
-        if (sscanf(ptr, "%hd %ld %hd", &t, &off, &len) == 3) {
-            array[count].op_type = t;
-            array[count].offset  = off;
-            array[count].length  = len;
-            count++;
+        char *b = pool->bufs[i];
+        switch (config.write_pattern) {
+            case WRITE_PATTERN_ZERO: memset(b, 0, len);   break;
+            case WRITE_PATTERN_FILL: memset(b, 'B', len); break;
+            case WRITE_PATTERN_RANDOM: fill_random(b, len, &state); break;
+            case WRITE_PATTERN_COMPRESSIBLE:
+                for (size_t off = 0; off < len; off += COMPRESS_CHUNK) {
+                    size_t chunk = len - off < COMPRESS_CHUNK ? len - off : COMPRESS_CHUNK;
+                    size_t rnd = (size_t)ceil(chunk / config.compress_ratio);
+                    fill_random(b + off, rnd, &state);
+                    memset(b + off + rnd, 0, chunk - rnd);
+                }
+                break;
         }
-        char *next = memchr(ptr, '\n', end - ptr);
-        if (!next) break;
-        ptr = next + 1;
     }
+    return 0;
+}
 
-    // Unmap the memory
-    munmap(data, filesize);
 
-    if (count == 0) {
-        free(array);
-        *reqs = NULL;
-        return 0;
+/**
+ * @brief Frees the pool of write payloads.
+ */
+static void write_pool_free(WritePool *pool) {
+    for (size_t i = 0; i < pool->count && pool->bufs; ++i) free(pool->bufs[i]);
+    free(pool->bufs);
+    pool->bufs = NULL;
+}
+
+
+/**
+ * @brief Returns the payload for a write request, outside of the timed region.
+ *
+ * In rotate mode buffers are used in turn; in hash mode the buffer is chosen
+ * by hashing the offset, so a rewrite of an offset sends the same data.
+ * For random and compressible payloads, the start of every COMPRESS_CHUNK is
+ * stamped with the offset (and the write sequence number in rotate mode), so
+ * that a deduplicating device never sees two identical blocks where the
+ * workload would not produce them.
+ *
+ * @param pool The pool of write payloads.
+ * @param r The write request.
+ * @return The buffer holding the payload.
+ */
+static char *write_pool_next(WritePool *pool, const IOReq *r) {
+    size_t idx;
+    uint64_t stamp[2] = { (uint64_t)r->offset, 0 };
+    if (config.write_select == WRITE_SELECT_HASH) {
+        uint64_t h = (uint64_t)r->offset * 0x9E3779B97F4A7C15ULL;
+        idx = (size_t)((h >> 32) % pool->count);
+    } else {
+        idx = pool->next;
+        pool->next = (pool->next + 1) % pool->count;
+        stamp[1] = pool->seq;
+    }
+    pool->seq++;
+
+    char *b = pool->bufs[idx];
+    if (config.write_pattern == WRITE_PATTERN_RANDOM || config.write_pattern == WRITE_PATTERN_COMPRESSIBLE) {
+        for (size_t off = 0; off + sizeof(stamp) <= pool->len; off += COMPRESS_CHUNK)
+            memcpy(b + off, stamp, sizeof(stamp));
     }
-    // Resize the array to the final size
-    IOReq *final = realloc(array, count * sizeof(IOReq));
-    *reqs = final ? final : array;
-    return count;
+    return b;
 }
 
 
 /**
- * @brief Prepares a memory-aligned I/O buffer for O_DIRECT operations.
- * @param reqs The array of I/O requests to determine the maximum length.
- * @param nreq The number of requests.
- * @param out_max_len A pointer to store the maximum buffer size.
- * @return A pointer to the allocated I/O buffer, or NULL on failure.
+ * @brief Grows the I/O buffer and the write pool so that they hold a request
+ * of need bytes. Only used by streamed replays, where the largest request is
+ * not known up front; called outside of the timed region. Sizes are rounded
+ * up to a power of two to keep the number of growths small. The pool keeps
+ * its rotation state and, being generated from the same seed, its content.
+ * @param buffer The I/O buffer, replaced on success.
+ * @param len The size of the I/O buffer, updated on success.
+ * @param pool The pool of write payloads.
+ * @param need The length of the request.
+ * @return 0 on success, -1 on failure.
  */
-static char *prepare_io_buffer(IOReq *reqs, size_t nreq, size_t *out_max_len) {
-    *out_max_len = 0;
-    for (size_t i = 0; i < nreq; ++i)
-        if ((size_t)reqs[i].length > *out_max_len)
-            *out_max_len = reqs[i].length;
-    if (*out_max_len == 0) *out_max_len = SECTOR_SIZE;
+static int grow_io_buffers(char **buffer, size_t *len, WritePool *pool, size_t need) {
+    size_t align = config.align > MIN_IO_ALIGN ? config.align : MIN_IO_ALIGN;
+    size_t new_len = align;
+    while (new_len < need) new_len *= 2;
 
     char *buf = NULL;
-    // Allocate memory aligned to the sector size
-    if (posix_memalign((void**)&buf, SECTOR_SIZE, *out_max_len) != 0) {
+    if (posix_memalign((void**)&buf, align, new_len) != 0) {
         perror("posix_memalign");
-        return NULL;
+        return -1;
     }
-    // Fill the buffer with some data
-    memset(buf, 'B', *out_max_len);
-    return buf;
+    memset(buf, 'B', new_len);
+    free(*buffer);
+    *buffer = buf;
+    *len = new_len;
+
+    size_t next = pool->next, seq = pool->seq;
+    write_pool_free(pool);
+    if (write_pool_init(pool, new_len) < 0) return -1;
+    pool->next = next;
+    pool->seq = seq;
+    return 0;
 }
 
 
@@ -168,85 +367,845 @@ static void drop_cache(void) {
 
 
 /**
- * @brief Replays the I/O requests and times each raw operation.
- * @param reqs The array of requests to replay.
- * @param nreq The number of requests.
- * @param buffer The I/O buffer.
- * @param io_wait_times_us An array to store the latency times in microseconds.
- * @param seek_distances An array to store the seek distances in bytes.
- * @return The number of successfully executed requests.
+ * @brief Applies the configured madvise hint to the whole data file mapping.
+ * @param ctx The replay context holding the mapping.
  */
-static size_t replay_requests_detailed(IOReq *reqs, size_t nreq, char *buffer,
-                                       size_t *io_wait_times_us,
-                                       long *seek_distances) {
-    // Use O_RDWR, O_SYNC, and O_DIRECT flags for non-cached I/O
-    int flags = O_RDWR | O_SYNC | O_DIRECT;
-    int fd = open64(config.data_file_path, flags);
+static void apply_madvise_hint(ReplayCtx *ctx) {
+    int advice;
+    switch (config.madvise_hint) {
+        case MADV_HINT_RANDOM:     advice = MADV_RANDOM;     break;
+        case MADV_HINT_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+        case MADV_HINT_WILLNEED:   advice = MADV_WILLNEED;   break;
+        default: return;
+    }
+    if (madvise(ctx->map, ctx->map_len, advice) < 0) perror("madvise");
+}
+
+
+// Index of the log-linear bucket holding a value
+static size_t hist_bucket(size_t v) {
+    if (v < HIST_SUB_BUCKETS) return v;
+    unsigned e = 63 - (unsigned)__builtin_clzll((unsigned long long)v);
+    return HIST_SUB_BUCKETS + (e - 4) * HIST_SUB_BUCKETS + ((v >> (e - 4)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Records a value (latency in us or distance in bytes) in a histogram.
+ */
+static void log_hist_add(LogHist *h, size_t v) {
+    h->count[hist_bucket(v)]++;
+    h->n++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+}
+
+
+/**
+ * @brief Returns the lower bound of a histogram bucket, in the unit of its values.
+ */
+static size_t hist_bucket_low(size_t b) {
+    if (b < HIST_SUB_BUCKETS) return b;
+    size_t e = (b - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS + 4;
+    size_t sub = (b - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    return (HIST_SUB_BUCKETS + sub) << (e - 4);
+}
+
+
+/**
+ * @brief Returns the given quantile of a histogram (lower bound of its bucket).
+ */
+static size_t log_hist_quantile(const LogHist *h, double q) {
+    size_t target = (size_t)(q * h->n), cum = 0;
+    for (size_t b = 0; b < NB_HIST_BUCKETS; ++b) {
+        cum += h->count[b];
+        if (cum > target) return hist_bucket_low(b);
+    }
+    return h->max;
+}
+
+
+/**
+ * @brief Returns the open(2) flags selected by --open-mode.
+ */
+static int replay_open_flags(void) {
+    switch (config.open_mode) {
+        case OPEN_DIRECT:   return O_RDWR | O_DIRECT;
+        case OPEN_BUFFERED: return O_RDWR;
+        default:            return O_RDWR | O_SYNC | O_DIRECT;
+    }
+}
+
+
+/**
+ * @brief Returns the slot of a file id, creating it (closed) if needed.
+ * Id 0 is the data file; other ids map to <scratch>/iortest.<id>.
+ * @return The slot, or NULL on allocation failure.
+ */
+static FileSlot *file_slot(ReplayCtx *ctx, int id) {
+    if ((size_t)id >= ctx->nb_files) {
+        size_t n = ctx->nb_files ? ctx->nb_files : 16;
+        while (n <= (size_t)id) n *= 2;
+        FileSlot *tmp = realloc(ctx->files, n * sizeof(FileSlot));
+        if (!tmp) {
+            perror("realloc file slots");
+            return NULL;
+        }
+        memset(tmp + ctx->nb_files, 0, (n - ctx->nb_files) * sizeof(FileSlot));
+        for (size_t i = ctx->nb_files; i < n; ++i) tmp[i].fd = -1;
+        ctx->files = tmp;
+        ctx->nb_files = n;
+    }
+    FileSlot *f = &ctx->files[id];
+    if (!f->path) {
+        if (id == 0) {
+            f->path = strdup(config.data_file_path);
+            f->exists = 1;
+        } else {
+            size_t len = strlen(config.scratch_dir) + 32;
+            f->path = malloc(len);
+            if (f->path) snprintf(f->path, len, "%s/iortest.%d", config.scratch_dir, id);
+        }
+        if (!f->path) {
+            perror("alloc file path");
+            return NULL;
+        }
+    }
+    return f;
+}
+
+
+/**
+ * @brief Makes sure the scratch directory exists. It is only created when
+ * the trace first needs a file other than the data file, so data-only
+ * replays do not need write access next to the data file.
+ * @return 0 on success, -1 on failure.
+ */
+static int scratch_dir_prepare(ReplayCtx *ctx) {
+    if (ctx->scratch_ready) return ctx->scratch_ready > 0 ? 0 : -1;
+    if (mkdir(config.scratch_dir, 0755) == 0) {
+        ctx->scratch_created = 1;
+    } else if (errno != EEXIST) {
+        perror("mkdir scratch dir");
+        ctx->scratch_ready = -1;   // Reported once, the ops on scratch files fail
+        return -1;
+    }
+    ctx->scratch_ready = 1;
+    return 0;
+}
+
+
+/**
+ * @brief Creates, untimed, a scratch file the trace uses without creating it
+ * (the file existed before the trace started). It is made a sparse file of
+ * --filesize bytes, so that it can be read.
+ * @return 0 on success, -1 on failure.
+ */
+static int file_materialize(ReplayCtx *ctx, FileSlot *f) {
+    if (scratch_dir_prepare(ctx) < 0) return -1;
+    int fd = open64(f->path, O_WRONLY | O_CREAT, 0644);
     if (fd < 0) {
-        perror("open64 data file");
+        perror("open64 scratch file");
+        return -1;
+    }
+    if (ftruncate64(fd, (off64_t)config.data_file_size) < 0) perror("ftruncate64 scratch file");
+    close(fd);
+    f->exists = 1;
+    ctx->materialized++;
+    return 0;
+}
+
+
+/**
+ * @brief Returns an open descriptor for a file id, opening it untimed if the
+ * trace did not.
+ * @return The descriptor, or -1 on failure.
+ */
+static int file_fd(ReplayCtx *ctx, int id) {
+    FileSlot *f = file_slot(ctx, id);
+    if (!f) return -1;
+    if (f->fd >= 0) return f->fd;
+    if (!f->exists && file_materialize(ctx, f) < 0) return -1;
+
+    f->fd = open64(f->path, replay_open_flags());
+    if (f->fd < 0) {
+        perror("open64 replay file");
+        return -1;
+    }
+    ctx->implicit_opens++;
+    return f->fd;
+}
+
+
+/**
+ * @brief Opens the data file for the selected engine.
+ * The syscall and bounce engines open it with the --open-mode flags
+ * (O_SYNC | O_DIRECT by default); the mmap
+ * engine maps the whole file shared, so that stores reach the file.
+ * @param ctx The replay context to initialize.
+ * @return 0 on success, -1 on error.
+ */
+static int engine_open(ReplayCtx *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    FileSlot *data = file_slot(ctx, 0);
+    if (!data) return -1;
+
+    if (config.engine != ENGINE_MMAP) {
+        if (file_fd(ctx, 0) < 0) {
+            return -1;
+        }
+        ctx->implicit_opens = 0;
+        if (config.engine == ENGINE_BOUNCE) {
+            ctx->bounce = calloc(config.bounce_pool, sizeof(char *));
+            if (!ctx->bounce) {
+                perror("calloc bounce pool");
+                return -1;
+            }
+        }
         return 0;
     }
 
-    // Initial drop_cache to clear the cache before starting the replay
-    drop_cache();
+    data->fd = open64(config.data_file_path, O_RDWR);
+    if (data->fd < 0) {
+        perror("open64 data file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(data->fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: cannot map an empty or unreadable data file.\n");
+        return -1;
+    }
+    ctx->map_len = (size_t)st.st_size;
+    ctx->map = mmap(NULL, ctx->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, data->fd, 0);
+    if (ctx->map == MAP_FAILED) {
+        perror("mmap data file");
+        ctx->map = NULL;
+        return -1;
+    }
+    apply_madvise_hint(ctx);
+    return 0;
+}
+
+
+/**
+ * @brief Releases the resources acquired by engine_open(): closes every file,
+ * removes the scratch files left by the trace and the scratch directory if
+ * the replay created it.
+ * @param ctx The replay context.
+ */
+static void engine_close(ReplayCtx *ctx) {
+    if (ctx->map) munmap(ctx->map, ctx->map_len);
+    ctx->map = NULL;
+    if (ctx->bounce) {
+        for (size_t i = 0; i < config.bounce_pool; ++i) free(ctx->bounce[i]);
+        free(ctx->bounce);
+        ctx->bounce = NULL;
+    }
+    for (size_t i = 0; i < ctx->nb_files; ++i) {
+        FileSlot *f = &ctx->files[i];
+        if (f->fd >= 0) close(f->fd);
+        if (i != 0 && f->exists && unlink(f->path) < 0) perror("unlink scratch file");
+        free(f->path);
+    }
+    free(ctx->files);
+    ctx->files = NULL;
+    ctx->nb_files = 0;
+    if (ctx->scratch_created && rmdir(config.scratch_dir) < 0) perror("rmdir scratch dir");
+    if (ctx->cpu_on) cpu_counters_close(&ctx->cpu);
+    if (ctx->cache_on) page_cache_close(&ctx->cache);
+    if (ctx->extents_on) extent_map_free(&ctx->extents);
+}
+
+
+/**
+ * @brief Hands out the next bounce buffer of the pool, in round-robin order.
+ * The pool grows lazily to the largest aligned span seen so far; the
+ * allocation happens before the timed region.
+ * @param ctx The replay context.
+ * @param span The number of bytes the buffer must hold (multiple of --align).
+ * @return An aligned buffer of at least span bytes, or NULL on failure.
+ */
+static char *bounce_get(ReplayCtx *ctx, size_t span) {
+    if (span > ctx->bounce_len) {
+        for (size_t i = 0; i < config.bounce_pool; ++i) {
+            free(ctx->bounce[i]);
+            ctx->bounce[i] = NULL;
+            if (posix_memalign((void**)&ctx->bounce[i], config.align, span) != 0) {
+                perror("posix_memalign bounce");
+                ctx->bounce_len = 0;
+                return NULL;
+            }
+        }
+        ctx->bounce_len = span;
+    }
+    char *b = ctx->bounce[ctx->bounce_next];
+    ctx->bounce_next = (ctx->bounce_next + 1) % config.bounce_pool;
+    return b;
+}
+
+
+/**
+ * @brief Reads one aligned sector into a bounce buffer for a read-modify-write.
+ * A short read (past the end of the file) leaves the missing part zeroed.
+ * @return The pread result.
+ */
+static ssize_t bounce_fill_sector(ReplayCtx *ctx, int fd, char *dst, off64_t pos) {
+    ssize_t got = pread64(fd, dst, config.align, pos);
+    ctx->dev_ops++;
+    if (got > 0) ctx->dev_bytes += (size_t)got;
+    if (got >= 0 && (size_t)got < config.align) memset(dst + got, 0, config.align - got);
+    return got;
+}
+
+
+/**
+ * @brief Executes a request through the bounce pool (bounce engine).
+ *
+ * Aligned requests go straight to the device from the I/O buffer. Others
+ * are widened to [start, end), the smallest --align aligned range covering
+ * them: reads fetch the whole range and copy the requested part out;
+ * writes first read back the partial head and tail sectors, merge the new
+ * data, then write the whole range. Must be called inside the timed region.
+ *
+ * @return The number of requested bytes transferred, or -1 on error.
+ */
+static ssize_t bounce_execute(ReplayCtx *ctx, int fd, const IOReq *r, char *buffer, char *b) {
+    const size_t a = config.align;
+    const size_t off = (size_t)r->offset, len = (size_t)r->length;
+    const size_t start = off - off % a;
+    const size_t end = (off + len + a - 1) / a * a;
+    const size_t span = end - start;
+
+    if (!b) {
+        // Aligned request: no bounce needed
+        ssize_t ret = (r->op_type == OP_READ) ? pread64(fd, buffer, len, off)
+                                              : pwrite64(fd, buffer, len, off);
+        ctx->dev_ops++;
+        if (ret > 0) ctx->dev_bytes += (size_t)ret;
+        return ret;
+    }
+
+    if (r->op_type == OP_READ) {
+        ssize_t got = pread64(fd, b, span, start);
+        ctx->dev_ops++;
+        if (got < 0) return -1;
+        ctx->dev_bytes += (size_t)got;
+        if ((size_t)got <= off - start) return 0;
+        size_t avail = (size_t)got - (off - start);
+        size_t n = avail < len ? avail : len;
+        memcpy(buffer, b + (off - start), n);
+        return (ssize_t)n;
+    }
+
+    // Read-modify-write of the partial head and tail sectors
+    int head = (off != start), tail = (off + len != end);
+    if (head || tail) ctx->rmw_ops++;
+    if (head && bounce_fill_sector(ctx, fd, b, start) < 0) return -1;
+    if (tail && !(head && span == a) && bounce_fill_sector(ctx, fd, b + span - a, end - a) < 0) return -1;
+    memcpy(b + (off - start), buffer, len);
+    ssize_t put = pwrite64(fd, b, span, start);
+    ctx->dev_ops++;
+    if (put < 0) return -1;
+    ctx->dev_bytes += (size_t)put;
+    return (ssize_t)len;
+}
+
+
+// CLOCK_MONOTONIC in nanoseconds
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
+
+/**
+ * @brief Starts the timed region of an op: reads the CPU counters and a
+ * nanosecond clock for the CPU/wait split, then the latency clock.
+ */
+static void op_clock_start(ReplayCtx *ctx, struct timeval *t) {
+    if (ctx->cpu_on) {
+        cpu_counters_read(&ctx->cpu, &ctx->cpu_before);
+        ctx->op_wall_start = mono_ns();
+    }
+    gettimeofday(t, NULL);
+}
+
+
+/**
+ * @brief Ends the timed region of an op: reads the latency clock, then the
+ * nanosecond clock and the CPU counters, whose difference (minus the
+ * reading cost) goes to ctx->cpu_op and ctx->op_wall_ns.
+ */
+static void op_clock_stop(ReplayCtx *ctx, struct timeval *t) {
+    gettimeofday(t, NULL);
+    if (!ctx->cpu_on) return;
+    ctx->op_wall_ns = mono_ns() - ctx->op_wall_start;
+    CpuSample after, delta;
+    cpu_counters_read(&ctx->cpu, &after);
+    cpu_sample_diff(&after, &ctx->cpu_before, &delta);
+    cpu_sample_diff(&delta, &ctx->cpu_baseline, &ctx->cpu_op);
+}
+
+
+/**
+ * @brief Opens the CPU counters and measures the cost of an empty timed
+ * region (the smallest of a few hundred readings), which is removed from
+ * every op.
+ */
+static void cpu_counters_setup(ReplayCtx *ctx) {
+    if (config.cpu_counters == CPU_COUNTERS_NONE) return;
+    if (cpu_counters_open(&ctx->cpu, config.cpu_counters == CPU_COUNTERS_RUSAGE) < 0) return;
+    ctx->cpu_on = 1;
+
+    struct timeval t;
+    for (int k = 0; k < NB_CPU_COUNTERS; ++k) ctx->cpu_baseline.v[k] = UINT64_MAX;
+    for (int i = 0; i < 256; ++i) {
+        CpuSample before, after, cost;
+        cpu_counters_read(&ctx->cpu, &before);
+        mono_ns();
+        gettimeofday(&t, NULL);
+        gettimeofday(&t, NULL);
+        mono_ns();
+        cpu_counters_read(&ctx->cpu, &after);
+        cpu_sample_diff(&after, &before, &cost);
+        for (int k = 0; k < NB_CPU_COUNTERS; ++k)
+            if (cost.v[k] < ctx->cpu_baseline.v[k]) ctx->cpu_baseline.v[k] = cost.v[k];
+    }
+}
+
+
+/**
+ * @brief Executes and times a metadata or durability op (syscall and bounce engines).
+ *
+ * open/create/close follow the trace: a second open of an already open file
+ * is timed and its descriptor closed untimed, and the matching close is timed
+ * on a dup of the descriptor, so each file keeps a single descriptor. fsync and
+ * fdatasync open the file untimed if needed. Opens truncate only when the
+ * traced call did (TRACE_OPEN_TRUNC), and never the data file, which
+ * make_file_if_necessary prepared; unlinking the data file is skipped too.
+ * A file the trace unlinks without having created or opened it existed before
+ * the trace (e.g. an old checkpoint) and is materialized untimed first. Ops
+ * that fail are counted in failed_ops, not recorded as latency samples.
+ *
+ * @param ctx The replay context.
+ * @param r The op to execute.
+ * @param op_us Receives the measured latency in microseconds.
+ * @return 0 on success, 1 if the op was not replayed or failed.
+ */
+static int meta_execute(ReplayCtx *ctx, const IOReq *r, size_t *op_us) {
     struct timeval t_start_op, t_end_op;
-    long last_offset = -1;
-    size_t executed = 0;
+    FileSlot *f = file_slot(ctx, r->file);
+    if (!f) return 1;
+    int ret = 0, fd = -1;
 
-    int fdcleancache = open("/proc/sys/vm/drop_caches", O_WRONLY);
-    if (fdcleancache < 0) {
-        perror("open drop_caches");
+    switch (r->op_type) {
+        case OP_OPEN:
+        case OP_CREATE: {
+            int flags = replay_open_flags();
+            if (r->op_type == OP_CREATE) flags |= O_CREAT;
+            if (r->op_type == OP_CREATE && r->file != 0 && scratch_dir_prepare(ctx) < 0) {
+                ctx->failed_ops++;
+                return 1;
+            }
+            if ((r->length & TRACE_OPEN_TRUNC) && r->file != 0) flags |= O_TRUNC;
+            // A file the trace opens before any create existed before the trace
+            if (r->op_type == OP_OPEN && !f->seen && !f->exists && file_materialize(ctx, f) < 0) {
+                ctx->failed_ops++;
+                return 1;
+            }
+            op_clock_start(ctx, &t_start_op);
+            fd = open64(f->path, flags, 0644);
+            op_clock_stop(ctx, &t_end_op);
+            if (fd < 0) { ret = -1; break; }
+            f->exists = 1;
+            f->refs++;
+            if (f->fd < 0) f->fd = fd;
+            else close(fd);
+            break;
+        }
+        case OP_CLOSE:
+            if (f->fd < 0 || f->refs == 0) {
+                ctx->skipped_ops++;
+                return 1;
+            }
+            fd = (f->refs > 1) ? dup(f->fd) : f->fd;
+            op_clock_start(ctx, &t_start_op);
+            ret = close(fd);
+            op_clock_stop(ctx, &t_end_op);
+            if (--f->refs == 0) f->fd = -1;
+            break;
+        case OP_FSYNC:
+        case OP_FDATASYNC:
+            if ((fd = file_fd(ctx, r->file)) < 0) return 1;
+            op_clock_start(ctx, &t_start_op);
+            ret = (r->op_type == OP_FSYNC) ? fsync(fd) : fdatasync(fd);
+            op_clock_stop(ctx, &t_end_op);
+            break;
+        case OP_UNLINK:
+            if (r->file == 0) {
+                ctx->skipped_ops++;
+                return 1;
+            }
+            if (!f->seen && !f->exists && file_materialize(ctx, f) < 0) {
+                ctx->failed_ops++;
+                return 1;
+            }
+            op_clock_start(ctx, &t_start_op);
+            ret = unlink(f->path);
+            op_clock_stop(ctx, &t_end_op);
+            // An open descriptor stays usable, as after a real unlink
+            if (ret == 0) f->exists = 0;
+            break;
+        default:
+            ctx->skipped_ops++;
+            return 1;
+    }
+    f->seen = 1;
+    if (ret < 0) {
+        ctx->failed_ops++;
+        return 1;
     }
 
-    for (size_t i = 0; i < nreq; ++i) {
-        IOReq *r = &reqs[i];
+    *op_us = (size_t)((t_end_op.tv_sec - t_start_op.tv_sec) * 1000000L + (t_end_op.tv_usec - t_start_op.tv_usec));
+    return 0;
+}
 
-        // Calculate the seek distance between requests
-        if (last_offset != -1) {
-            seek_distances[i] = llabs(r->offset - last_offset);
-        } else {
-            seek_distances[i] = 0;
+
+/**
+ * @brief Executes one request with the selected engine and times it.
+ *
+ * syscall: lseek outside the timed region, then a timed read/write.
+ * mmap:    a timed memcpy from/to the mapping; writes are followed by an
+ *          msync(MS_SYNC) of the touched pages, inside the timed region,
+ *          to match the O_SYNC semantics of the syscall engine. The minor
+ *          and major fault counts of the access are taken with getrusage.
+ *          Only the data file can be replayed; fsync/fdatasync become an
+ *          msync of the whole mapping and the other metadata ops are skipped.
+ *
+ * @param ctx The replay context.
+ * @param r The request to execute.
+ * @param buffer The destination of a read or the payload of a write.
+ * @param op_us Receives the measured latency in microseconds.
+ * @return 0 on success, 1 if the request was skipped or failed (no latency sample),
+ *         -1 if the replay must stop.
+ */
+static int engine_execute(ReplayCtx *ctx, const IOReq *r, char *buffer, size_t *op_us) {
+    struct timeval t_start_op, t_end_op;
+
+    // Only the data file is mapped: ops on other files are skipped like the unsupported metadata ops
+    if (config.engine == ENGINE_MMAP && r->file != 0) {
+        if (ctx->skipped_files++ == 0)
+            fprintf(stderr, "WARNING: the mmap engine only replays the data file, ops on other files are skipped.\n");
+        ctx->skipped_ops++;
+        return 1;
+    }
+    if (!IS_DATA_OP(r->op_type)) {
+        if (config.engine != ENGINE_MMAP) return meta_execute(ctx, r, op_us);
+        if (r->op_type != OP_FSYNC && r->op_type != OP_FDATASYNC) {
+            ctx->skipped_ops++;
+            return 1;
+        }
+        op_clock_start(ctx, &t_start_op);
+        int ret = msync(ctx->map, ctx->map_len, MS_SYNC);
+        op_clock_stop(ctx, &t_end_op);
+        if (ret < 0) {
+            ctx->failed_ops++;
+            return 1;
         }
+        *op_us = (size_t)((t_end_op.tv_sec - t_start_op.tv_sec) * 1000000L + (t_end_op.tv_usec - t_start_op.tv_usec));
+        return 0;
+    }
 
+    if (config.engine == ENGINE_SYSCALL) {
+        int fd = file_fd(ctx, r->file);
+        if (fd < 0) {
+            ctx->failed_ops++;
+            return 1;
+        }
         // Position the read/write head (seek)
         if (lseek64(fd, r->offset, SEEK_SET) < 0) {
             perror("lseek64");
-            break;
+            return -1;
         }
-        
+
         // Start timing
-        gettimeofday(&t_start_op, NULL);
-        
+        op_clock_start(ctx, &t_start_op);
+
         // Execute the I/O operation (read or write)
-        ssize_t ret = (r->op_type == 0) ? read(fd, buffer, r->length) : write(fd, buffer, r->length);
-        
+        ssize_t ret = (r->op_type == OP_READ) ? read(fd, buffer, r->length) : write(fd, buffer, r->length);
+
         // Stop timing
-        gettimeofday(&t_end_op, NULL);
-        
-        // Calculate the total duration of the operation in microseconds
-        size_t total_op_us = (size_t)((t_end_op.tv_sec - t_start_op.tv_sec) * 1000000L + (t_end_op.tv_usec - t_start_op.tv_usec));
-        
-        // Store the measured time
-        io_wait_times_us[i] = total_op_us;
+        op_clock_stop(ctx, &t_end_op);
+
+        ctx->dev_ops++;
+        if (ret > 0) ctx->dev_bytes += (size_t)ret;
+        // A failed call (EINVAL on an unaligned O_DIRECT request) is not a latency sample
+        if (ret < 0) {
+            ctx->failed_ops++;
+            return 1;
+        }
+    } else if (config.engine == ENGINE_BOUNCE) {
+        if (r->offset < 0) {
+            fprintf(stderr, "Error: negative offset %ld in trace.\n", r->offset);
+            return -1;
+        }
+        int fd = file_fd(ctx, r->file);
+        if (fd < 0) {
+            ctx->failed_ops++;
+            return 1;
+        }
+        // Pick the bounce buffer before timing; aligned requests need none
+        char *b = NULL;
+        size_t a = config.align;
+        if ((size_t)r->offset % a || (size_t)r->length % a) {
+            size_t start = (size_t)r->offset - (size_t)r->offset % a;
+            size_t end = ((size_t)r->offset + r->length + a - 1) / a * a;
+            b = bounce_get(ctx, end - start);
+            if (!b) return -1;
+            ctx->unaligned_ops++;
+        }
+
+        op_clock_start(ctx, &t_start_op);
+        ssize_t ret = bounce_execute(ctx, fd, r, buffer, b);
+        op_clock_stop(ctx, &t_end_op);
+
+        if (ret < 0) {
+            ctx->failed_ops++;
+            return 1;
+        }
+    } else {
+        if (r->offset < 0 || (size_t)r->offset + (size_t)r->length > ctx->map_len) {
+            fprintf(stderr, "Error: request [%ld, +%d) is outside the mapped data file.\n",
+                    r->offset, r->length);
+            return -1;
+        }
+        char *addr = ctx->map + r->offset;
+        struct rusage ru_before, ru_after;
+        getrusage(RUSAGE_THREAD, &ru_before);
+
+        op_clock_start(ctx, &t_start_op);
+        if (r->op_type == OP_READ) {
+            memcpy(buffer, addr, r->length);
+        } else {
+            memcpy(addr, buffer, r->length);
+            // msync needs a page-aligned start address
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t skew = (size_t)r->offset % page;
+            if (msync(addr - skew, r->length + skew, MS_SYNC) < 0) perror("msync");
+        }
+        op_clock_stop(ctx, &t_end_op);
+
+        getrusage(RUSAGE_THREAD, &ru_after);
+        size_t minflt = (size_t)(ru_after.ru_minflt - ru_before.ru_minflt);
+        size_t majflt = (size_t)(ru_after.ru_majflt - ru_before.ru_majflt);
+        ctx->minor_faults += minflt;
+        ctx->major_faults += majflt;
+        if (majflt > 0) {
+            ctx->major_fault_ops++;
+            ctx->major_fault_us += (size_t)((t_end_op.tv_sec - t_start_op.tv_sec) * 1000000L + (t_end_op.tv_usec - t_start_op.tv_usec));
+        }
+        ctx->dev_ops++;
+        ctx->dev_bytes += (size_t)r->length;
+    }
+
+    ctx->req_ops++;
+    ctx->req_bytes += (size_t)r->length;
+
+    // Calculate the total duration of the operation in microseconds
+    *op_us = (size_t)((t_end_op.tv_sec - t_start_op.tv_sec) * 1000000L + (t_end_op.tv_usec - t_start_op.tv_usec));
+    return 0;
+}
+
+
+/**
+ * @brief Unmaps the pages of the data file so that drop_caches can evict them.
+ * Pages still mapped by the process are skipped by drop_caches, so the mmap
+ * engine has to release its page table entries before the flush. The whole
+ * mapping is released, not only the request: fault-around also maps the
+ * neighbouring pages that were already cached.
+ * @param ctx The replay context.
+ * @param r The request that was just executed.
+ */
+static void engine_release(ReplayCtx *ctx, const IOReq *r) {
+    if (config.engine != ENGINE_MMAP || !IS_DATA_OP(r->op_type)) return;
+    if (madvise(ctx->map, ctx->map_len, MADV_DONTNEED) < 0) perror("madvise DONTNEED");
+}
+
+
+/**
+ * @brief Replays the I/O requests and times each raw operation.
+ * @param ctx The replay context, filled with the engine counters.
+ * @param reqs The array of requests to replay (NULL when stream is set).
+ * @param nreq The number of requests (0 when stream is set).
+ * @param stream The streamed trace, or NULL to replay reqs.
+ * @param buffer The I/O buffer, used as the destination of reads (grown for streamed traces).
+ * @param buffer_len The size of the I/O buffer.
+ * @param pool The pool providing the payload of writes.
+ * @param io_wait_times_us An array to store the latency times of the reads and writes in
+ * microseconds (NULL when streaming); metadata ops only go to their histograms.
+ * @param seek_distances An array to store the seek distances of the reads and writes in bytes
+ * (NULL when streaming). Both arrays hold ctx->data_ops entries.
+ * @return The number of successfully executed requests.
+ */
+static size_t replay_requests_detailed(ReplayCtx *ctx, IOReq *reqs, size_t nreq, TraceStream *stream,
+                                       char **buffer, size_t *buffer_len,
+                                       WritePool *pool,
+                                       size_t *io_wait_times_us,
+                                       long *seek_distances) {
+    // Initial drop_cache to clear the cache before starting the replay
+    // (done before opening so that a WILLNEED hint is not flushed right away)
+    if (config.drop_policy != DROP_CACHE_NONE) drop_cache();
+
+    if (engine_open(ctx) < 0) {
+        engine_close(ctx);
+        ctx->aborted = 1;
+        return 0;
+    }
+
+    long last_offset = -1;
+    size_t executed = 0;
+
+    // State of the cache as the first op will see it
+    if (config.cache_check != CACHE_CHECK_NONE && page_cache_open(&ctx->cache, config.data_file_path) == 0) {
+        ctx->cache_on = 1;
+        page_cache_range(&ctx->cache, 0, 0, &ctx->cache_start);
+    }
+
+    // Physical layout of the data file, after the engine created or opened it
+    if (config.extents && extent_map_load(&ctx->extents, config.data_file_path) == 0) {
+        ctx->extents_on = 1;
+        extent_summary(&ctx->extents, &ctx->extent_summary);
+        ctx->data_size = ctx->extents.file_size;
+    }
+
+    // Streamed replays do not keep the latencies, so the log is written during the loop
+    if (stream && config.latency_log) {
+        ctx->lat_log = fopen(config.latency_log, "w");
+        if (!ctx->lat_log) perror("fopen latency log");
+        else setvbuf(ctx->lat_log, NULL, _IOFBF, 1 << 20);
+    }
+
+    // CPU counters of the whole loop, next to the per-op ones
+    cpu_counters_setup(ctx);
+    CpuSample run_start, run_end;
+    struct timeval run_t0, run_t1;
+    if (ctx->cpu_on) cpu_counters_read(&ctx->cpu, &run_start);
+    gettimeofday(&run_t0, NULL);
 
-        last_offset = r->offset;
+    int fdcleancache = -1;
+    if (config.drop_policy == DROP_CACHE_OP) {
+        fdcleancache = open("/proc/sys/vm/drop_caches", O_WRONLY);
+        if (fdcleancache < 0) {
+            perror("open drop_caches");
+        }
+    }
+
+    for (size_t i = 0; ; ++i) {
+        // A streamed trace is replayed chunk by chunk, as the loader delivers them
+        if (i == nreq) {
+            if (!stream || (nreq = trace_stream_next(stream, &reqs)) == 0) break;
+            i = 0;
+        }
+        IOReq *r = &reqs[i];
+
+        if ((size_t)r->length > *buffer_len) {
+            if (grow_io_buffers(buffer, buffer_len, pool, r->length) < 0) break;
+            ctx->buffer_growths++;
+        }
+
+        // Reads land in the I/O buffer, writes take their payload from the pool
+        char *data = (r->op_type == OP_WRITE) ? write_pool_next(pool, r) : *buffer;
+
+        // Residency of the pages a read is about to touch, untimed
+        PageCacheState before_read = { 0, 0, 0 };
+        if (ctx->cache_on && config.cache_check == CACHE_CHECK_OP && r->op_type == OP_READ && r->file == 0)
+            page_cache_range(&ctx->cache, (size_t)r->offset, (size_t)r->length, &before_read);
+
+        // Execute and time the request with the selected engine
+        size_t total_op_us;
+        int status = engine_execute(ctx, r, data, &total_op_us);
+        if (status < 0) {
+            ctx->aborted = 1;
+            break;
+        }
+        if (status > 0) {
+            continue;
+        }
+
+        // Calculate the seek distance between data requests
+        long seek = (IS_DATA_OP(r->op_type) && last_offset != -1) ? llabs(r->offset - last_offset) : 0;
+        if (seek_distances && IS_DATA_OP(r->op_type)) seek_distances[ctx->data_ops] = seek;
+        if (IS_DATA_OP(r->op_type)) last_offset = r->offset;
+
+        // Physical seek and extent crossings of data file requests
+        if (ctx->extents_on && IS_DATA_OP(r->op_type) && r->file == 0 && r->offset >= 0) {
+            uint64_t phys, log_seek, phys_seek;
+            size_t cross;
+            if (extent_request(&ctx->extents, &ctx->extent_cursor, (uint64_t)r->offset, (uint64_t)r->length,
+                               &phys, &log_seek, &phys_seek, &cross) == 0) {
+                log_hist_add(&ctx->seek_logical, (size_t)log_seek);
+                log_hist_add(&ctx->seek_physical, (size_t)phys_seek);
+            } else {
+                ctx->unmapped_ops++;
+            }
+            ctx->crossings += cross;
+            if (cross > 0) ctx->crossing_ops++;
+        }
+
+        // Store the measured time
+        if (io_wait_times_us && IS_DATA_OP(r->op_type)) io_wait_times_us[ctx->data_ops] = total_op_us;
+        if (ctx->lat_log && IS_DATA_OP(r->op_type)) fprintf(ctx->lat_log, "%zu\n", total_op_us);
+        log_hist_add(&ctx->hist[r->op_type], total_op_us);
+        if (IS_DATA_OP(r->op_type)) {
+            ctx->lat_sq_us += (double)total_op_us * total_op_us;
+            ctx->data_ops++;
+        }
+        if (ctx->cpu_on) {
+            for (int k = 0; k < NB_CPU_COUNTERS; ++k) ctx->cpu_sum[r->op_type].v[k] += ctx->cpu_op.v[k];
+            ctx->wall_sum_ns[r->op_type] += ctx->op_wall_ns;
+        }
+        if (before_read.pages > 0) {
+            ctx->cache_probe_ops++;
+            ctx->cache_probe_pages += before_read.pages;
+            ctx->cache_hit_pages += before_read.resident;
+            if (before_read.resident == before_read.pages) ctx->cache_hit_ops++;
+        }
         executed++;
 
         // Perform sync and cache flush operations after the measurement
         // and outside the timed loop
-        sync();
-        if (fdcleancache >= 0) {
-            if (write(fdcleancache, "3", 1) < 0) {
-                fprintf(stderr, "cache flush failed, need root\n");
+        if (config.drop_policy == DROP_CACHE_OP) {
+            engine_release(ctx, r);
+            sync();
+            if (fdcleancache >= 0) {
+                if (write(fdcleancache, "3", 1) < 0) {
+                    fprintf(stderr, "cache flush failed, need root\n");
+                }
             }
         }
+
+        // Periodic residency sample, after the flush so that it shows what the next op sees
+        if (ctx->cache_on && config.cache_interval > 0 && executed % config.cache_interval == 0) {
+            PageCacheState st;
+            if (page_cache_range(&ctx->cache, 0, 0, &st) == 0)
+                printf("Cache @ op %zu: %zu / %zu pages resident (%.2f%%), %zu dirty\n",
+                    executed, st.resident, st.pages, st.pages ? 100.0 * st.resident / st.pages : 0.0, st.dirty);
+        }
+    }
+
+    gettimeofday(&run_t1, NULL);
+    if (ctx->cache_on) page_cache_range(&ctx->cache, 0, 0, &ctx->cache_end);
+    ctx->run_us = (size_t)((run_t1.tv_sec - run_t0.tv_sec) * 1000000L + (run_t1.tv_usec - run_t0.tv_usec));
+    if (ctx->cpu_on) {
+        cpu_counters_read(&ctx->cpu, &run_end);
+        cpu_sample_diff(&run_end, &run_start, &ctx->cpu_run);
     }
 
     if (fdcleancache >= 0) {
         close(fdcleancache);
     }
-    close(fd);
+    if (ctx->lat_log) fclose(ctx->lat_log);
+    engine_close(ctx);
     return executed;
 }
 
@@ -300,6 +1259,266 @@ static void print_detailed_stats(size_t n,
 }
 
 
+/**
+ * @brief Same line as print_detailed_stats, computed from the latency
+ * read and write histograms for streamed replays, where latencies are not
+ * kept one by one. The mean and the CI are exact, the quartiles are bucket lower bounds
+ * (about 6% relative precision).
+ * @param ctx The replay context.
+ */
+static void print_hist_stats(const ReplayCtx *ctx) {
+    LogHist all;
+    memset(&all, 0, sizeof(all));
+    for (int op = 0; op < NB_OP_TYPES; ++op) {
+        if (!IS_DATA_OP(op)) continue;
+        for (size_t b = 0; b < NB_HIST_BUCKETS; ++b) all.count[b] += ctx->hist[op].count[b];
+        all.n += ctx->hist[op].n;
+        all.sum += ctx->hist[op].sum;
+        if (ctx->hist[op].max > all.max) all.max = ctx->hist[op].max;
+    }
+    if (all.n == 0) return;
+
+    double mean = (double)all.sum / all.n;
+    double var = ctx->lat_sq_us / all.n - mean * mean;
+    double ci_95 = 1.96 * (sqrt(var > 0 ? var : 0) / sqrt(all.n));
+    printf("Mean: %f ms     95%% CI: \xc2\xb1%f ms     Q1: %f ms     Median: %f ms     Q3: %f ms\n",
+        mean / 1000.0,
+        ci_95 / 1000.0,
+        log_hist_quantile(&all, 0.25) / 1000.0,
+        log_hist_quantile(&all, 0.5) / 1000.0,
+        log_hist_quantile(&all, 0.75) / 1000.0);
+}
+
+
+/**
+ * @brief Displays the loader and stall counters of a streamed replay.
+ * @param st The counters returned by trace_stream_close.
+ * @param chunk_reqs The number of requests per chunk.
+ * @param ctx The replay context.
+ */
+static void print_stream_stats(const TraceStreamStats *st, size_t chunk_reqs, const ReplayCtx *ctx) {
+    printf("Stream: %zu requests in %zu chunks     Window: %d x %zu requests (%zu KiB)     "
+           "Startup: %.3f ms     Loader busy: %.3f ms, waited %zu times / %.3f ms\n",
+        st->requests, st->chunks, config.stream_buffers, chunk_reqs,
+        config.stream_buffers * chunk_reqs * sizeof(IOReq) / 1024,
+        st->startup_us / 1000.0, st->loader_busy_us / 1000.0, st->loader_waits, st->loader_wait_us / 1000.0);
+    printf("Loader stalls: %zu     Stall time: %.3f ms     Buffer growths: %zu\n",
+        st->replay_stalls, st->replay_stall_us / 1000.0, ctx->buffer_growths);
+    if (st->replay_stalls > 0)
+        fprintf(stderr, "WARNING: the replay waited %zu times for the trace loader; "
+                "a larger --stream-window may hide these stalls.\n", st->replay_stalls);
+    if (st->error)
+        fprintf(stderr, "WARNING: the trace could not be read to the end.\n");
+}
+
+
+/**
+ * @brief Displays the I/O amplification of the bounce engine and the failed requests.
+ * @param ctx The replay context.
+ */
+static void print_amplification_stats(const ReplayCtx *ctx) {
+    if (config.engine == ENGINE_BOUNCE && ctx->req_ops > 0 && ctx->req_bytes > 0) {
+        printf("Requested: %zu bytes / %zu ops     Device: %zu bytes / %zu ops     "
+               "Amplification: %.3fx bytes, %.3fx ops     Unaligned: %zu     RMW: %zu\n",
+            ctx->req_bytes, ctx->req_ops, ctx->dev_bytes, ctx->dev_ops,
+            (double)ctx->dev_bytes / ctx->req_bytes, (double)ctx->dev_ops / ctx->req_ops,
+            ctx->unaligned_ops, ctx->rmw_ops);
+    }
+    if (ctx->failed_ops > 0) {
+        fprintf(stderr, "WARNING: %zu requests failed", ctx->failed_ops);
+        if (config.engine == ENGINE_SYSCALL)
+            fprintf(stderr, " (unaligned requests are rejected by O_DIRECT, see --engine bounce)");
+        fprintf(stderr, "; they are left out of the latency statistics.\n");
+    }
+}
+
+
+/**
+ * @brief Displays the per-op-type latency breakdown and histograms.
+ * Only printed when the trace holds other ops than reads and writes.
+ * @param ctx The replay context.
+ */
+static void print_op_stats(const ReplayCtx *ctx) {
+    size_t total_us = 0, meta_us = 0, meta_ops = 0;
+    for (int op = 0; op < NB_OP_TYPES; ++op) {
+        total_us += ctx->hist[op].sum;
+        if (!IS_DATA_OP(op)) {
+            meta_us += ctx->hist[op].sum;
+            meta_ops += ctx->hist[op].n;
+        }
+    }
+    if (meta_ops == 0 && ctx->skipped_ops == 0) return;
+
+    printf("%-10s %10s %12s %10s %10s %10s %8s\n", "Op", "Count", "Total ms", "Mean ms", "Median ms", "P99 ms", "Share");
+    for (int op = 0; op < NB_OP_TYPES; ++op) {
+        const LogHist *h = &ctx->hist[op];
+        if (h->n == 0) continue;
+        printf("%-10s %10zu %12.3f %10.6f %10.6f %10.6f %7.2f%%\n",
+            trace_op_name(op), h->n, h->sum / 1000.0, (double)h->sum / h->n / 1000.0,
+            log_hist_quantile(h, 0.5) / 1000.0, log_hist_quantile(h, 0.99) / 1000.0,
+            total_us ? 100.0 * h->sum / total_us : 0.0);
+    }
+    printf("Metadata share of I/O time: %.2f%%     Skipped ops: %zu     Implicit opens: %zu     Materialized files: %zu\n",
+        total_us ? 100.0 * meta_us / total_us : 0.0, ctx->skipped_ops, ctx->implicit_opens, ctx->materialized);
+
+    // Histograms, one line per op type, grouped by power of two (bucket: count)
+    for (int op = 0; op < NB_OP_TYPES; ++op) {
+        const LogHist *h = &ctx->hist[op];
+        if (h->n == 0) continue;
+        printf("%-10s hist (us >= bucket):", trace_op_name(op));
+        for (size_t b = 0; b < NB_HIST_BUCKETS; ) {
+            size_t low = hist_bucket_low(b), sum = 0;
+            size_t next = b + 1;
+            if (b > 0) while (next < NB_HIST_BUCKETS && hist_bucket_low(next) < 2 * low) next++;
+            for (size_t k = b; k < next; ++k) sum += h->count[k];
+            if (sum) printf(" %zu:%zu", low, sum);
+            b = next;
+        }
+        printf("\n");
+    }
+}
+
+
+/**
+ * @brief Displays the CPU cost of the ops next to their latency.
+ * CPU is the task-clock of the timed region and Wait the rest of its
+ * CLOCK_MONOTONIC time, spent off-CPU waiting for the device; both are in
+ * nanoseconds over the same window, while Latency is the microsecond
+ * gettimeofday time of the other statistics. Counters the backend cannot
+ * measure are shown as "-".
+ * @param ctx The replay context.
+ */
+static void print_cpu_stats(const ReplayCtx *ctx) {
+    if (!ctx->cpu_on) return;
+    const CpuCounters *c = &ctx->cpu;
+    printf("CPU counters: %s%s     Read cost removed per op: %" PRIu64 " ns task-clock",
+        c->backend == CPU_BACKEND_PERF ? "perf_event" : "getrusage",
+        c->backend == CPU_BACKEND_RUSAGE ? "" : c->user_only ? " (user only)" : " (user+kernel)",
+        ctx->cpu_baseline.v[CPU_TASK_CLOCK]);
+    if (c->available[CPU_CYCLES]) printf(", %" PRIu64 " cycles", ctx->cpu_baseline.v[CPU_CYCLES]);
+    printf("\n");
+
+    printf("%-10s %10s %12s %12s %12s %7s %12s %12s %6s %10s %10s\n", "Op", "Count", "Latency us", "CPU us",
+        "Wait us", "CPU%", "Cycles", "Instr", "IPC", "CtxSw/op", "Migr");
+    for (int op = 0; op < NB_OP_TYPES; ++op) {
+        const LogHist *h = &ctx->hist[op];
+        if (h->n == 0) continue;
+        const uint64_t *v = ctx->cpu_sum[op].v;
+        double lat = (double)h->sum / h->n;
+        double wall = ctx->wall_sum_ns[op] / 1000.0 / h->n;
+        double cpu = v[CPU_TASK_CLOCK] / 1000.0 / h->n;
+        printf("%-10s %10zu %12.3f %12.3f %12.3f %6.1f%%", trace_op_name(op), h->n, lat, cpu,
+            wall > cpu ? wall - cpu : 0.0, wall > 0 ? 100.0 * cpu / wall : 0.0);
+        if (c->available[CPU_CYCLES]) printf(" %12.0f", (double)v[CPU_CYCLES] / h->n);
+        else printf(" %12s", "-");
+        if (c->available[CPU_INSTRUCTIONS]) printf(" %12.0f", (double)v[CPU_INSTRUCTIONS] / h->n);
+        else printf(" %12s", "-");
+        if (c->available[CPU_CYCLES] && c->available[CPU_INSTRUCTIONS] && v[CPU_CYCLES] > 0)
+            printf(" %6.2f", (double)v[CPU_INSTRUCTIONS] / v[CPU_CYCLES]);
+        else printf(" %6s", "-");
+        printf(" %10.3f", (double)v[CPU_CTX_SWITCHES] / h->n);
+        if (c->available[CPU_MIGRATIONS]) printf(" %10" PRIu64 "\n", v[CPU_MIGRATIONS]);
+        else printf(" %10s\n", "-");
+    }
+
+    // Whole replay loop, including the untimed work (seeks, cache flushes, payloads)
+    const uint64_t *v = ctx->cpu_run.v;
+    printf("Run: wall %.3f ms     task-clock %.3f ms (%.1f%%)", ctx->run_us / 1000.0,
+        v[CPU_TASK_CLOCK] / 1e6, ctx->run_us ? 100.0 * v[CPU_TASK_CLOCK] / 1000.0 / ctx->run_us : 0.0);
+    if (c->available[CPU_CYCLES]) printf("     cycles %" PRIu64, v[CPU_CYCLES]);
+    if (c->available[CPU_INSTRUCTIONS]) printf("     instructions %" PRIu64, v[CPU_INSTRUCTIONS]);
+    if (c->available[CPU_CYCLES] && c->available[CPU_INSTRUCTIONS] && v[CPU_CYCLES] > 0)
+        printf("     IPC %.2f", (double)v[CPU_INSTRUCTIONS] / v[CPU_CYCLES]);
+    printf("     context switches %" PRIu64, v[CPU_CTX_SWITCHES]);
+    if (c->available[CPU_MIGRATIONS]) printf("     migrations %" PRIu64, v[CPU_MIGRATIONS]);
+    printf("\n");
+}
+
+
+/**
+ * @brief Displays the page-cache residency of the data file and warns when
+ * a configuration that should be cold (--drop-cache op or start) is not.
+ * Reads can only be served from the cache by the mmap engine and by
+ * buffered opens; O_DIRECT reads bypass it, so no warning is given then.
+ * @param ctx The replay context.
+ */
+static void print_cache_stats(const ReplayCtx *ctx) {
+    if (!ctx->cache_on) return;
+    const PageCacheState *a = &ctx->cache_start, *b = &ctx->cache_end;
+    size_t page = ctx->cache.page;
+    printf("Page cache (%s): start %zu / %zu KiB resident (%.2f%%)     end %zu KiB resident (%.2f%%)",
+        page_cache_backend(&ctx->cache), a->resident * page / 1024, a->pages * page / 1024,
+        a->pages ? 100.0 * a->resident / a->pages : 0.0,
+        b->resident * page / 1024, b->pages ? 100.0 * b->resident / b->pages : 0.0);
+    if (ctx->cache.use_cachestat) printf(", %zu KiB dirty", b->dirty * page / 1024);
+    printf("\n");
+
+    int cached_reads = (config.engine == ENGINE_MMAP || config.open_mode == OPEN_BUFFERED);
+    double hit = ctx->cache_probe_pages ? (double)ctx->cache_hit_pages / ctx->cache_probe_pages : 0.0;
+    if (ctx->cache_probe_ops > 0)
+        printf("Read hit ratio (estimated): %.2f%% of pages     Fully cached reads: %zu / %zu%s\n",
+            100.0 * hit, ctx->cache_hit_ops, ctx->cache_probe_ops,
+            cached_reads ? "" : "     (O_DIRECT reads bypass the cache)");
+
+    if (!cached_reads || config.drop_policy == DROP_CACHE_NONE) return;
+    if (a->pages > 0 && a->resident * 100 > a->pages)
+        fprintf(stderr, "WARNING: the cache is not cold at the start of the replay: %.2f%% of the data file "
+                "is resident after drop_caches (is the replay running as root?).\n", 100.0 * a->resident / a->pages);
+    if (config.drop_policy == DROP_CACHE_OP && hit > 0.01)
+        fprintf(stderr, "WARNING: %.2f%% of the pages read were already cached despite the per-op cache drop.\n",
+                100.0 * hit);
+}
+
+
+/**
+ * @brief Displays the fragmentation of the data file and compares logical
+ * and physical seek distances. Both go from the end of the previous mapped
+ * request to the start of the next one, unlike the start-to-start seeks of
+ * the detailed statistics, so their ratio does not depend on request size.
+ * @param ctx The replay context.
+ */
+static void print_extent_stats(const ReplayCtx *ctx) {
+    if (!ctx->extents_on) return;
+    const ExtentSummary *es = &ctx->extent_summary;
+    printf("Extents: %zu in %zu fragments     Median fragment: %" PRIu64 " KiB     Largest: %" PRIu64 " KiB     "
+           "Holes: %zu     Unwritten: %zu     Mapped: %.2f%%     Physical span: %" PRIu64 " MiB\n",
+        es->extents, es->fragments, es->median / 1024, es->largest / 1024, es->holes, es->unwritten,
+        ctx->data_size ? 100.0 * es->mapped_bytes / ctx->data_size : 0.0, es->span >> 20);
+
+    const LogHist *l = &ctx->seek_logical, *p = &ctx->seek_physical;
+    size_t mapped = p->n;
+    if (mapped > 0) {
+        printf("Seek (KiB)   %12s %12s %12s %12s\n", "Mean", "Median", "P90", "Max");
+        printf("Logical      %12.1f %12.1f %12.1f %12.1f\n", (double)l->sum / mapped / 1024,
+            log_hist_quantile(l, 0.5) / 1024.0, log_hist_quantile(l, 0.9) / 1024.0, l->max / 1024.0);
+        printf("Physical     %12.1f %12.1f %12.1f %12.1f\n", (double)p->sum / mapped / 1024,
+            log_hist_quantile(p, 0.5) / 1024.0, log_hist_quantile(p, 0.9) / 1024.0, p->max / 1024.0);
+    }
+    printf("Extent crossings: %zu     Per request: %.3f     Requests crossing: %zu     Unmapped requests: %zu\n",
+        ctx->crossings, mapped + ctx->unmapped_ops ? (double)ctx->crossings / (mapped + ctx->unmapped_ops) : 0.0,
+        ctx->crossing_ops, ctx->unmapped_ops);
+    if (ctx->unmapped_ops > 0)
+        fprintf(stderr, "WARNING: %zu requests started in a hole of the data file; write the whole file "
+                "before the replay for physical seeks to be exact.\n", ctx->unmapped_ops);
+}
+
+
+/**
+ * @brief Displays the page-fault counters collected by the mmap engine.
+ * @param ctx The replay context.
+ * @param n The number of executed requests.
+ */
+static void print_fault_stats(const ReplayCtx *ctx, size_t n) {
+    if (config.engine != ENGINE_MMAP) return;
+    printf("Minor faults: %zu     Major faults: %zu     Ops with major faults: %zu / %zu",
+        ctx->minor_faults, ctx->major_faults, ctx->major_fault_ops, n);
+    if (ctx->major_fault_ops > 0)
+        printf("     Mean latency of those ops: %f ms",
+            (double)ctx->major_fault_us / ctx->major_fault_ops / 1000.0);
+    printf("\n");
+}
+
+
 /* ----------------- main ----------------- */
 int main(int argc, char **argv) {
     // Parse command-line arguments
@@ -309,51 +1528,121 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    fprintf(stderr, "INFO: Loading trace from '%s'...\n", config.trace_path);
+    // Scratch files go next to the data file by default, to hit the same device
+    static char scratch_default[4096];
+    if (!config.scratch_dir) {
+        char *copy = strdup(config.data_file_path);
+        if (!copy) { perror("strdup"); return EXIT_FAILURE; }
+        snprintf(scratch_default, sizeof(scratch_default), "%s/iortest_scratch", dirname(copy));
+        free(copy);
+        config.scratch_dir = scratch_default;
+    }
+
     IOReq *reqs = NULL;
-    size_t nreq = load_trace(config.trace_path, &reqs);
-    if (nreq == 0) {
-        fprintf(stderr, "Error: No valid requests were loaded.\n");
-        return EXIT_FAILURE;
+    size_t nreq = 0;
+    TraceStream *stream = NULL;
+    size_t chunk_reqs = 0;
+    if (config.stream) {
+        // Bounded memory: the window is split in stream_buffers chunks
+        chunk_reqs = config.stream_window / config.stream_buffers;
+        if (chunk_reqs == 0) chunk_reqs = 1;
+        fprintf(stderr, "INFO: Streaming trace from '%s' (%d chunks of %zu requests)...\n",
+                config.trace_path, config.stream_buffers, chunk_reqs);
+        stream = trace_stream_open(config.trace_path, chunk_reqs, config.stream_buffers);
+        if (!stream) {
+            fprintf(stderr, "Error: Cannot stream the trace.\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        fprintf(stderr, "INFO: Loading trace from '%s'...\n", config.trace_path);
+        nreq = load_trace(config.trace_path, &reqs);
+        if (nreq == 0) {
+            fprintf(stderr, "Error: No valid requests were loaded.\n");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "INFO: %zu requests loaded.\n", nreq);
     }
-    fprintf(stderr, "INFO: %zu requests loaded.\n", nreq);
 
+    // Streamed traces start with a one-sector buffer that grows with the requests
     size_t max_len = 0;
     char *buffer = prepare_io_buffer(reqs, nreq, &max_len);
     if (!buffer) {
         free(reqs);
+        trace_stream_close(stream, NULL);
         return EXIT_FAILURE;
     }
     fprintf(stderr, "INFO: I/O buffer of %zu bytes prepared.\n", max_len);
 
-    // Allocate arrays to store the metrics
-    size_t *io_wait_raw_us = calloc(nreq, sizeof(size_t));
-    long *seek_bytes = calloc(nreq, sizeof(long));
-    if (!io_wait_raw_us || !seek_bytes) {
+    // Pre-generate the write payloads before anything is timed
+    WritePool pool;
+    if (write_pool_init(&pool, max_len) < 0) {
+        write_pool_free(&pool);
+        free(reqs); free(buffer);
+        trace_stream_close(stream, NULL);
+        return EXIT_FAILURE;
+    }
+    static const char *pattern_names[] = { "random", "compressible", "zero", "fill" };
+    fprintf(stderr, "INFO: Write pool of %zu x %zu bytes prepared (%s", pool.count, max_len,
+            pattern_names[config.write_pattern]);
+    if (config.write_pattern == WRITE_PATTERN_COMPRESSIBLE)
+        fprintf(stderr, ", ratio %.2f", config.compress_ratio);
+    fprintf(stderr, ", %s).\n", config.write_select == WRITE_SELECT_HASH ? "offset hash" : "rotate");
+
+    // Allocate arrays to store the metrics (streamed replays only keep histograms)
+    size_t *io_wait_raw_us = NULL;
+    long *seek_bytes = NULL;
+    if (!stream) {
+        io_wait_raw_us = calloc(nreq, sizeof(size_t));
+        seek_bytes = calloc(nreq, sizeof(long));
+    }
+    if (!stream && (!io_wait_raw_us || !seek_bytes)) {
         perror("calloc metrics");
+        write_pool_free(&pool);
         free(reqs); free(buffer);
         free(io_wait_raw_us); free(seek_bytes);
         return EXIT_FAILURE;
     }
 
-    fprintf(stderr, "INFO: Starting replay...\n");
+    fprintf(stderr, "INFO: Starting replay (%s engine)...\n",
+            config.engine == ENGINE_MMAP ? "mmap" :
+            config.engine == ENGINE_BOUNCE ? "bounce" : "syscall");
     // Execute the request replay and collect data
-    size_t executed = replay_requests_detailed(reqs, nreq, buffer,
+    ReplayCtx ctx;
+    size_t executed = replay_requests_detailed(&ctx, reqs, nreq, stream, &buffer, &max_len, &pool,
                                                io_wait_raw_us, seek_bytes);
+    TraceStreamStats stream_stats;
+    if (stream) trace_stream_close(stream, &stream_stats);
     fprintf(stderr, "INFO: Replay finished. %zu requests executed.\n", executed);
 
     if (executed > 0) {
-        // Display statistics if requests were executed
-        print_detailed_stats(executed, io_wait_raw_us, seek_bytes);
+        // Display statistics if requests were executed; the mean, CI and quartile line covers reads and writes only
+        if (stream) {
+            print_hist_stats(&ctx);
+            print_stream_stats(&stream_stats, chunk_reqs, &ctx);
+        } else {
+            if (ctx.data_ops > 0) print_detailed_stats(ctx.data_ops, io_wait_raw_us, seek_bytes);
+            if (config.latency_log) log_times(config.latency_log, io_wait_raw_us, ctx.data_ops);
+        }
+        print_fault_stats(&ctx, ctx.data_ops);
+        print_amplification_stats(&ctx);
+        print_op_stats(&ctx);
+        print_cpu_stats(&ctx);
+        print_cache_stats(&ctx);
+        print_extent_stats(&ctx);
     } else {
         fprintf(stderr, "INFO: No requests executed, no statistics.\n");
     }
+    // A truncated run must not pass for a complete one
+    if (ctx.aborted)
+        fprintf(stderr, "Error: the replay stopped before the end of the trace, "
+                        "the statistics above only cover the first %zu requests.\n", executed);
 
     // Free all allocated memory
+    write_pool_free(&pool);
     free(reqs);
     free(buffer);
     free(io_wait_raw_us);
     free(seek_bytes);
-    return EXIT_SUCCESS;
+    return ctx.aborted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
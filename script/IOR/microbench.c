@@ -0,0 +1,409 @@
+/**
+ * microbench.c
+ *
+ * Times the hot paths of the replay harness itself, so that a regression in
+ * our own code does not end up in the I/O measurements:
+ *  - trace loading: load_trace, the streaming reader, trace_parse_line;
+ *  - the filter_traces parser, run on a generated strace log;
+ *  - calculate_stats and make_file_if_necessary from tools.c;
+ *  - the per-op overhead of the replay: the clock pair around each op, the
+ *    CPU counter reads (--cpu-counters), the page-cache probe
+ *    (--cache-check op) and the extent lookup (--extents).
+ *
+ * Every benchmark runs on generated inputs of increasing size and prints
+ * ns per op (per request, line, sample or byte range) and MB/s where a
+ * volume of data is processed. Each figure is the best of REPEATS runs.
+ *
+ * --quick uses smaller sizes (for the PGO training run of the Makefile).
+ *
+ */
+
+#include "tools.h"          // For calculate_stats, make_file_if_necessary.
+#include "trace.h"          // For load_trace, trace_parse_line and the streaming reader.
+#include "cpu_counters.h"   // For the CPU counter reads.
+#include "page_cache.h"     // For the page-cache probe.
+#include "extents.h"        // For the extent lookup.
+#include <stdio.h>          // For fopen, fprintf, printf.
+#include <stdlib.h>         // For malloc, free, EXIT_FAILURE.
+#include <string.h>         // For strcmp, memchr.
+#include <stdint.h>         // For uint64_t.
+#include <time.h>           // For clock_gettime.
+#include <fcntl.h>          // For open.
+#include <unistd.h>         // For fork, execv, dup2, unlink.
+#include <sys/wait.h>       // For waitpid.
+#include <sys/time.h>       // For gettimeofday.
+#include <sys/stat.h>       // For stat.
+
+#define REPEATS 3
+
+static const char *bench_dir = "/tmp";
+static volatile uint64_t sink;      /* Keeps the results of the timed loops alive */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Prints one result line.
+ * @param name The benchmark.
+ * @param size The input size (requests, lines, samples or bytes).
+ * @param ops The number of ops the time is divided by.
+ * @param bytes The bytes processed (0 if not meaningful).
+ * @param ns The best time of the runs.
+ */
+static void report(const char *name, const char *size, size_t ops, size_t bytes, double ns) {
+    printf("%-28s %12s %14.1f", name, size, ns / ops);
+    if (bytes > 0) printf(" %12.1f\n", bytes / (ns / 1e9) / (1024 * 1024));
+    else printf(" %12s\n", "-");
+}
+
+
+/**
+ * @brief Formats a size: in MiB for byte sizes, as is for counts.
+ */
+static void size_label(char *buf, size_t len, size_t n, int bytes) {
+    if (bytes) snprintf(buf, len, "%zuM", n >> 20);
+    else snprintf(buf, len, "%zu", n);
+}
+
+
+static size_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+
+/**
+ * @brief Writes a filtered trace of n requests (mostly data ops, a few
+ * metadata ops with the four-column format).
+ */
+static int write_trace(const char *path, size_t n) {
+    FILE *f = fopen(path, "w");
+    if (!f) { perror("fopen trace"); return -1; }
+    fprintf(f, "Nature_operation Offset Taille_requete\n--------------------------------------\n");
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t r = next_random();
+        if (r % 64 == 0)
+            fprintf(f, "%d 0 0 %d\n", 2 + (int)(r >> 8) % 6, 1 + (int)(r >> 16) % 4);
+        else
+            fprintf(f, "%d %lu %d\n", (int)(r >> 8) & 1, (unsigned long)((r >> 16) % (1UL << 34)) & ~511UL,
+                    512 << ((r >> 40) % 8));
+    }
+    return fclose(f);
+}
+
+
+/**
+ * @brief Writes an strace -yy log of n lines, in the form filter_traces expects.
+ */
+static int write_strace_log(const char *path, size_t n) {
+    FILE *f = fopen(path, "w");
+    if (!f) { perror("fopen strace log"); return -1; }
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t r = next_random();
+        switch (r % 8) {
+            case 0:
+                fprintf(f, "[pid 4242] lseek(3</data/ior_testfile>, %lu, SEEK_SET) = %lu\n",
+                        (unsigned long)(r >> 20) & ~511UL, (unsigned long)(r >> 20) & ~511UL);
+                break;
+            case 1:
+                fprintf(f, "[pid 4242] openat(AT_FDCWD</data>, \"ior_testfile\", O_RDWR|O_CREAT, 0644) = 3</data/ior_testfile>\n");
+                break;
+            case 2:
+                fprintf(f, "[pid 4242] fsync(3</data/ior_testfile>) = 0\n");
+                break;
+            default:
+                fprintf(f, "[pid 4242] %s(3</data/ior_testfile>, \"\\x00\\x01\\x02\"..., 4096) = 4096\n",
+                        (r >> 8) & 1 ? "write" : "read");
+                break;
+        }
+    }
+    return fclose(f);
+}
+
+
+static void bench_trace(const size_t *sizes, int nb_sizes) {
+    char path[4096], label[32];
+    for (int s = 0; s < nb_sizes; ++s) {
+        size_t n = sizes[s];
+        snprintf(path, sizeof(path), "%s/microbench_trace_%zu.txt", bench_dir, n);
+        if (write_trace(path, n) < 0) return;
+        size_t bytes = file_size(path);
+        size_label(label, sizeof(label), n, 0);
+
+        double best = 1e300;
+        size_t nreq = 0;
+        for (int k = 0; k < REPEATS; ++k) {
+            IOReq *reqs = NULL;
+            double t0 = now_ns();
+            nreq = load_trace(path, &reqs);
+            double t = now_ns() - t0;
+            free(reqs);
+            if (t < best) best = t;
+        }
+        report("load_trace", label, nreq ? nreq : 1, bytes, best);
+
+        best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            double t0 = now_ns();
+            TraceStream *st = trace_stream_open(path, 65536, 3);
+            if (!st) break;
+            IOReq *reqs;
+            while (trace_stream_next(st, &reqs) > 0) {}
+            trace_stream_close(st, NULL);
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        report("trace_stream", label, n, bytes, best);
+
+        // The parser alone, on the trace already in memory
+        char *buf = malloc(bytes);
+        FILE *f = fopen(path, "r");
+        if (buf && f && fread(buf, 1, bytes, f) == bytes) {
+            best = 1e300;
+            for (int k = 0; k < REPEATS; ++k) {
+                IOReq r;
+                size_t parsed = 0;
+                double t0 = now_ns();
+                for (char *p = buf, *end = buf + bytes, *nl; p < end; p = nl + 1) {
+                    if (!(nl = memchr(p, '\n', end - p))) break;
+                    parsed += trace_parse_line(p, nl, &r);
+                }
+                double t = now_ns() - t0;
+                if (t < best) best = t;
+                if (parsed == 0) fprintf(stderr, "warning: no request parsed\n");
+            }
+            report("trace_parse_line", label, n, bytes, best);
+        }
+        if (f) fclose(f);
+        free(buf);
+        unlink(path);
+    }
+}
+
+
+static void bench_filter(const size_t *sizes, int nb_sizes, const char *filter) {
+    if (access(filter, X_OK) != 0) {
+        fprintf(stderr, "INFO: %s not found, filter_traces benchmark skipped (see --filter).\n", filter);
+        return;
+    }
+    char path[4096], label[32];
+    for (int s = 0; s < nb_sizes; ++s) {
+        size_t n = sizes[s];
+        snprintf(path, sizeof(path), "%s/microbench_strace_%zu.log", bench_dir, n);
+        if (write_strace_log(path, n) < 0) return;
+        size_label(label, sizeof(label), n, 0);
+
+        // Process start-up is included; it is negligible from 100k lines on
+        double best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            double t0 = now_ns();
+            pid_t pid = fork();
+            if (pid == 0) {
+                int null = open("/dev/null", O_WRONLY);
+                if (null >= 0) dup2(null, STDOUT_FILENO);
+                execl(filter, filter, "--metadata", path, (char *)NULL);
+                _exit(127);
+            }
+            int status = 0;
+            if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "warning: %s failed\n", filter);
+                unlink(path);
+                return;
+            }
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        report("filter_traces --metadata", label, n, file_size(path), best);
+        unlink(path);
+    }
+}
+
+
+static void bench_stats(const size_t *sizes, int nb_sizes) {
+    char label[32];
+    for (int s = 0; s < nb_sizes; ++s) {
+        size_t n = sizes[s];
+        size_t *times = malloc(n * sizeof(size_t));
+        if (!times) { perror("malloc times"); return; }
+        for (size_t i = 0; i < n; ++i) times[i] = 50 + next_random() % 20000;
+        size_label(label, sizeof(label), n, 0);
+
+        double best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            ReplayStats st;
+            double t0 = now_ns();
+            calculate_stats(times, n, n * 4096, NULL, NULL, &st);
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        report("calculate_stats", label, n, n * sizeof(size_t), best);
+        free(times);
+    }
+}
+
+
+static void bench_make_file(const size_t *sizes, int nb_sizes) {
+    char path[4096], label[32];
+    snprintf(path, sizeof(path), "%s/microbench_data.bin", bench_dir);
+    for (int s = 0; s < nb_sizes; ++s) {
+        size_t n = sizes[s];
+        size_label(label, sizeof(label), n, 1);
+        double best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            unlink(path);
+            // make_file_if_necessary announces the creation on stdout
+            fflush(stdout);
+            int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, STDOUT_FILENO);
+            double t0 = now_ns();
+            make_file_if_necessary(path, n);
+            double t = now_ns() - t0;
+            fflush(stdout);
+            if (saved >= 0) { dup2(saved, STDOUT_FILENO); close(saved); }
+            if (null >= 0) close(null);
+            if (t < best) best = t;
+        }
+        report("make_file_if_necessary", label, 1, n, best);
+    }
+    unlink(path);
+}
+
+
+static void bench_overhead(size_t iters) {
+    char label[32];
+    size_label(label, sizeof(label), iters, 0);
+
+    // Clock pair around each timed op
+    struct timeval tv;
+    double best = 1e300;
+    for (int k = 0; k < REPEATS; ++k) {
+        double t0 = now_ns();
+        for (size_t i = 0; i < iters; ++i) { gettimeofday(&tv, NULL); gettimeofday(&tv, NULL); }
+        double t = now_ns() - t0;
+        if (t < best) best = t;
+    }
+    report("gettimeofday pair", label, iters, 0, best);
+
+    struct timespec ts;
+    best = 1e300;
+    for (int k = 0; k < REPEATS; ++k) {
+        double t0 = now_ns();
+        for (size_t i = 0; i < iters; ++i) { clock_gettime(CLOCK_MONOTONIC, &ts); clock_gettime(CLOCK_MONOTONIC, &ts); }
+        double t = now_ns() - t0;
+        if (t < best) best = t;
+    }
+    report("clock_gettime pair", label, iters, 0, best);
+
+    // CPU counter pair (--cpu-counters), with both backends
+    for (int force_rusage = 0; force_rusage <= 1; ++force_rusage) {
+        CpuCounters c;
+        if (cpu_counters_open(&c, force_rusage) < 0) continue;
+        if (!force_rusage && c.backend != CPU_BACKEND_PERF) { cpu_counters_close(&c); continue; }
+        CpuSample a;
+        best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            double t0 = now_ns();
+            for (size_t i = 0; i < iters; ++i) { cpu_counters_read(&c, &a); cpu_counters_read(&c, &a); }
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        report(force_rusage ? "cpu_counters pair (rusage)" : "cpu_counters pair (perf)", label, iters, 0, best);
+        cpu_counters_close(&c);
+    }
+
+    // Page-cache probe of a 4 KiB read (--cache-check op), on a 64 MiB sparse file
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/microbench_probe.bin", bench_dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, 64 << 20) == 0) {
+        close(fd);
+        PageCacheProbe p;
+        if (page_cache_open(&p, path) == 0) {
+            PageCacheState st;
+            best = 1e300;
+            for (int k = 0; k < REPEATS; ++k) {
+                double t0 = now_ns();
+                for (size_t i = 0; i < iters; ++i)
+                    page_cache_range(&p, (next_random() % (64 << 20)) & ~4095UL, 4096, &st);
+                double t = now_ns() - t0;
+                if (t < best) best = t;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "page_cache_range (%s)", page_cache_backend(&p));
+            report(name, label, iters, 0, best);
+            page_cache_close(&p);
+        }
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    unlink(path);
+
+    // Extent lookup (--extents) in a map of 1M fragments
+    ExtentMap m = { NULL, 1 << 20, (uint64_t)(1 << 20) * 65536 };
+    m.ext = malloc(m.count * sizeof(Extent));
+    if (m.ext) {
+        for (size_t i = 0; i < m.count; ++i) {
+            m.ext[i].logical = (uint64_t)i * 65536;
+            m.ext[i].physical = (next_random() % (1ULL << 40)) & ~4095ULL;
+            m.ext[i].length = 65536;
+            m.ext[i].flags = 0;
+        }
+        uint64_t phys, sum = 0;
+        best = 1e300;
+        for (int k = 0; k < REPEATS; ++k) {
+            double t0 = now_ns();
+            for (size_t i = 0; i < iters; ++i)
+                if (extent_physical(&m, next_random() % m.file_size, &phys) == 0) sum += phys;
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        sink = sum;
+        report("extent_physical (1M ext)", label, iters, 0, best);
+        free(m.ext);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int quick = 0;
+    const char *filter = "./filter_traces";
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) quick = 1;
+        else if (!strcmp(argv[i], "--dir") && i + 1 < argc) bench_dir = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) filter = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--quick] [--dir <tmp dir>] [--filter <filter_traces binary>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static const size_t full_sizes[] = { 10000, 100000, 1000000 };
+    static const size_t quick_sizes[] = { 1000, 10000, 100000 };
+    static const size_t full_files[] = { 16 << 20, 128 << 20 };
+    static const size_t quick_files[] = { 4 << 20 };
+    const size_t *sizes = quick ? quick_sizes : full_sizes;
+    const size_t *files = quick ? quick_files : full_files;
+    int nb_files = quick ? 1 : 2;
+
+    printf("%-28s %12s %14s %12s\n", "Benchmark", "Size", "ns/op", "MB/s");
+    bench_trace(sizes, 3);
+    bench_filter(sizes, 3, filter);
+    bench_stats(sizes, 3);
+    bench_make_file(files, nb_files);
+    bench_overhead(quick ? 100000 : 1000000);
+    return EXIT_SUCCESS;
+}
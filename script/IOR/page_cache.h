@@ -0,0 +1,39 @@
+/**
+ * page_cache.h
+ *
+ * Page-cache residency of a file, used to check that a cold-cache replay
+ * really starts cold and to estimate how many reads were served from memory.
+ *
+ * Residency is read with the cachestat syscall (Linux 6.5+), which also
+ * reports dirty pages, or else with mincore on a read-only mapping of the
+ * file that is never touched, so probing does not itself bring pages in.
+ *
+ */
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stddef.h>     // For size_t.
+
+typedef struct {
+    int    fd;              /* Read-only descriptor of the probed file */
+    size_t size;            /* Size of the file in bytes */
+    size_t page;            /* Page size */
+    int    use_cachestat;   /* cachestat works on this kernel */
+    char  *map;             /* mincore backend: mapping of the whole file */
+    unsigned char *vec;     /* mincore backend: residency vector of one window */
+} PageCacheProbe;
+
+// Residency of a range of the file
+typedef struct {
+    size_t pages;           /* Pages in the range */
+    size_t resident;        /* Pages in the page cache */
+    size_t dirty;           /* Dirty pages (cachestat only, 0 otherwise) */
+} PageCacheState;
+
+int page_cache_open(PageCacheProbe *p, const char *path);
+int page_cache_range(PageCacheProbe *p, size_t off, size_t len, PageCacheState *st);
+void page_cache_close(PageCacheProbe *p);
+const char *page_cache_backend(const PageCacheProbe *p);
+
+#endif // PAGE_CACHE_H
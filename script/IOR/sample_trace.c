@@ -0,0 +1,307 @@
+/**
+ * sample_trace.c
+ *
+ * Downsamples a filtered I/O trace to a representative, smaller trace.
+ *
+ * Requests are selected by spatial hash sampling: the data file is cut into
+ * regions of --region bytes and each region gets a pseudo-random value
+ * u = hash(region, seed). A request is kept when the u of its region falls
+ * under a threshold, so a selected region keeps all of its requests and the
+ * access locality (sequential runs, re-reads) survives the sampling.
+ *
+ * Thresholds are set per stratum (op type x size bucket x seek-distance
+ * bucket) so that every stratum keeps the requested share of its requests,
+ * which preserves the read/write mix and the size and seek distributions.
+ * The share is rounded at random, so a stratum too small for its share is
+ * kept or left out whole and the sample size is right on average.
+ * The trace is read twice: the first pass builds, per stratum, a histogram
+ * of the region hash values; the second pass emits the selected requests.
+ * Memory use does not depend on the trace length.
+ *
+ * Metadata and durability ops (open, close, fsync, ...) are always kept, so
+ * that the file lifecycle of the sampled trace stays valid; only read and
+ * write requests are sampled.
+ *
+ * A fidelity check comparing the full trace and the sample is printed on
+ * stderr; the sampled trace goes to stdout.
+ *
+ */
+
+#include "tools.h"      // For get_val_arg.
+#include "trace.h"      // For IOReq and trace_parse_line.
+#include <stdio.h>      // For fopen, getline, printf, fprintf.
+#include <stdlib.h>     // For calloc, free, strtod, strtoull.
+#include <string.h>     // For strcmp.
+#include <stdint.h>     // For uint64_t.
+#include <math.h>       // For fabs, llround.
+
+#define NB_OPS         NB_OP_TYPES  /* Op types kept apart */
+#define NB_SIZE_BKT    32    /* log2 buckets of the request size */
+#define NB_SEEK_STRAT  16    /* log4 buckets of the seek distance, for stratification */
+#define NB_SEEK_BKT    64    /* log2 buckets of the seek distance, for the fidelity check */
+#define NB_STRATA      (NB_OPS * NB_SIZE_BKT * NB_SEEK_STRAT)
+#define NB_U_BINS      1024  /* Resolution of the per-stratum hash histogram */
+#define TVD_WARN       0.05  /* Total variation distance above which the sample is flagged */
+
+// Characteristics of a trace, used by the fidelity check
+typedef struct {
+    size_t n;                        /* Number of requests */
+    size_t ops[NB_OPS];              /* Requests per op type */
+    size_t size_hist[NB_SIZE_BKT];   /* Requests per log2 size bucket */
+    size_t seek_hist[NB_SEEK_BKT];   /* Requests per log2 seek-distance bucket */
+    double bytes;                    /* Total requested bytes */
+    size_t sequential;               /* Requests starting where the previous one ended */
+    long   last_offset;              /* Offset of the previous request, -1 if none */
+    long   last_end;                 /* End of the previous request */
+} TraceProfile;
+
+// Sampling state of one stratum
+typedef struct {
+    size_t *u_hist;    /* Requests per hash bin (first pass) */
+    size_t  total;     /* Requests in the stratum */
+    size_t  cut_bin;   /* Bins below cut_bin are kept */
+    double  cut_frac;  /* Share of bin cut_bin that is kept */
+} Stratum;
+
+
+/**
+ * @brief Returns the log2 bucket of a value: 0 for 0, floor(log2(v)) + 1 otherwise.
+ */
+static unsigned log2_bucket(unsigned long v, unsigned nb_buckets) {
+    unsigned b = 0;
+    while (v) { b++; v >>= 1; }
+    return b < nb_buckets ? b : nb_buckets - 1;
+}
+
+
+/**
+ * @brief splitmix64 finalizer, used as the region hash.
+ */
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+/**
+ * @brief Computes the seek distance of a request, as iortest1.c does
+ * (absolute distance between the offsets of consecutive requests).
+ */
+static unsigned long seek_distance(long last_offset, const IOReq *r) {
+    return last_offset < 0 ? 0 : (unsigned long)labs(r->offset - last_offset);
+}
+
+
+/**
+ * @brief Accounts one request in a trace profile.
+ */
+static void profile_add(TraceProfile *p, const IOReq *r) {
+    unsigned long seek = seek_distance(p->last_offset, r);
+    p->n++;
+    p->ops[(unsigned)r->op_type % NB_OPS]++;
+    p->size_hist[log2_bucket((unsigned long)r->length, NB_SIZE_BKT)]++;
+    p->seek_hist[log2_bucket(seek, NB_SEEK_BKT)]++;
+    p->bytes += r->length;
+    if (p->last_offset >= 0 && r->offset == p->last_end) p->sequential++;
+    p->last_offset = r->offset;
+    p->last_end = r->offset + r->length;
+}
+
+
+/**
+ * @brief Total variation distance between two histograms, normalized by their totals.
+ */
+static double tvd(const size_t *a, size_t na, const size_t *b, size_t nb, size_t nbins) {
+    if (na == 0 || nb == 0) return 0.0;
+    double d = 0.0;
+    for (size_t i = 0; i < nbins; ++i)
+        d += fabs((double)a[i] / na - (double)b[i] / nb);
+    return d / 2.0;
+}
+
+
+/**
+ * @brief Returns the lower bound of the log2 bucket holding the given quantile.
+ */
+static unsigned long hist_quantile(const size_t *hist, size_t nbins, size_t n, double q) {
+    size_t target = (size_t)(q * n), cum = 0;
+    for (size_t i = 0; i < nbins; ++i) {
+        cum += hist[i];
+        if (cum > target) return i == 0 ? 0 : 1UL << (i - 1);
+    }
+    return nbins == 0 ? 0 : 1UL << (nbins - 2);
+}
+
+
+/**
+ * @brief Prints the fidelity check comparing the full trace and the sample.
+ * @return 1 if the sample is representative (all distances under TVD_WARN), 0 otherwise.
+ */
+static int print_fidelity(const TraceProfile *full, const TraceProfile *smp) {
+    double tvd_ops  = tvd(full->ops, full->n, smp->ops, smp->n, NB_OPS);
+    double tvd_size = tvd(full->size_hist, full->n, smp->size_hist, smp->n, NB_SIZE_BKT);
+    double tvd_seek = tvd(full->seek_hist, full->n, smp->seek_hist, smp->n, NB_SEEK_BKT);
+    size_t fn = full->n ? full->n : 1, sn = smp->n ? smp->n : 1;
+
+    fprintf(stderr, "\n--- Fidelity check (full trace -> sample) ---\n");
+    fprintf(stderr, "Requests            : %zu -> %zu (ratio %.4f)\n", full->n, smp->n, (double)smp->n / fn);
+    fprintf(stderr, "Read fraction       : %.4f -> %.4f\n", (double)full->ops[0] / fn, (double)smp->ops[0] / sn);
+    fprintf(stderr, "Mean size (bytes)   : %.1f -> %.1f\n", full->bytes / fn, smp->bytes / sn);
+    fprintf(stderr, "Sequential fraction : %.4f -> %.4f\n", (double)full->sequential / fn, (double)smp->sequential / sn);
+    fprintf(stderr, "Median seek (bytes) : >= %lu -> >= %lu\n",
+            hist_quantile(full->seek_hist, NB_SEEK_BKT, full->n, 0.5),
+            hist_quantile(smp->seek_hist, NB_SEEK_BKT, smp->n, 0.5));
+    fprintf(stderr, "P90 seek (bytes)    : >= %lu -> >= %lu\n",
+            hist_quantile(full->seek_hist, NB_SEEK_BKT, full->n, 0.9),
+            hist_quantile(smp->seek_hist, NB_SEEK_BKT, smp->n, 0.9));
+    fprintf(stderr, "TVD op / size / seek: %.4f / %.4f / %.4f\n", tvd_ops, tvd_size, tvd_seek);
+
+    int ok = tvd_ops < TVD_WARN && tvd_size < TVD_WARN && tvd_seek < TVD_WARN;
+    if (ok)
+        fprintf(stderr, "Verdict             : representative (all TVD < %.2f)\n", TVD_WARN);
+    else
+        fprintf(stderr, "Verdict             : WARNING, sample diverges from the full trace "
+                        "(try a larger ratio or a smaller --region)\n");
+    return ok;
+}
+
+
+/**
+ * @brief Computes the stratum and hash value of a request.
+ * @param last_offset The offset of the previous request of the full trace, -1 if none.
+ * @param r The request.
+ * @param region The region size in bytes.
+ * @param seed The sampling seed.
+ * @param h Receives the 64-bit region hash.
+ * @return The stratum index.
+ */
+static size_t classify(long last_offset, const IOReq *r, size_t region, uint64_t seed, uint64_t *h) {
+    unsigned op = (unsigned)r->op_type % NB_OPS;
+    unsigned sb = log2_bucket((unsigned long)r->length, NB_SIZE_BKT);
+    unsigned kb = (log2_bucket(seek_distance(last_offset, r), 2 * NB_SEEK_STRAT) + 1) / 2;
+    if (kb >= NB_SEEK_STRAT) kb = NB_SEEK_STRAT - 1;
+    *h = mix64(((uint64_t)r->offset / region) ^ ((uint64_t)r->file << 48) ^ seed);
+    return ((size_t)op * NB_SIZE_BKT + sb) * NB_SEEK_STRAT + kb;
+}
+
+
+int main(int argc, char **argv) {
+    double ratio = 0.0;
+    size_t target = 0, region = 1 << 20;
+    uint64_t seed = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--ratio") && i + 1 < argc) ratio = strtod(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--target") && i + 1 < argc) target = get_val_arg(argv[++i]);
+        else if (!strcmp(argv[i], "--region") && i + 1 < argc) region = get_val_arg(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else path = argv[i];
+    }
+    if (!path || (ratio <= 0.0 && target == 0) || ratio > 1.0 || region == 0) {
+        fprintf(stderr, "Usage: %s (--ratio <0..1> | --target <N requests>) [--region <size>] [--seed <N>] <filtered_trace>\n", argv[0]);
+        fprintf(stderr, "  --region <size>   Spatial sampling unit, e.g. 64k, 1M (default: 1M)\n");
+        fprintf(stderr, "The sampled trace is written to stdout, the fidelity check to stderr.\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Cannot open the trace file");
+        return EXIT_FAILURE;
+    }
+
+    Stratum *strata = calloc(NB_STRATA, sizeof(Stratum));
+    if (!strata) { perror("calloc strata"); fclose(file); return EXIT_FAILURE; }
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t line_len;
+    size_t meta_ops = 0;
+    IOReq r;
+    uint64_t h;
+    TraceProfile full = { .last_offset = -1 }, smp = { .last_offset = -1 };
+
+    // First pass: hash histogram of every stratum
+    while ((line_len = getline(&line, &len, file)) != -1) {
+        if (!trace_parse_line(line, line + line_len, &r)) continue;
+        if (!IS_DATA_OP(r.op_type)) { meta_ops++; continue; }
+        Stratum *s = &strata[classify(full.last_offset, &r, region, seed, &h)];
+        if (!s->u_hist && !(s->u_hist = calloc(NB_U_BINS, sizeof(size_t)))) {
+            perror("calloc stratum");
+            return EXIT_FAILURE;
+        }
+        s->u_hist[h >> 54]++;
+        s->total++;
+        profile_add(&full, &r);
+    }
+    if (full.n == 0) {
+        fprintf(stderr, "Error: No read/write requests in '%s'.\n", path);
+        return EXIT_FAILURE;
+    }
+    if (target > 0) ratio = target >= full.n ? 1.0 : (double)target / full.n;
+
+    // Per-stratum threshold: keep ratio * total requests, rounded up or down at
+    // random (by the fractional part), so that the expected size of the sample
+    // is exact and sparse strata are not inflated by a minimum of one
+    size_t dropped_strata = 0, dropped_reqs = 0;
+    for (size_t i = 0; i < NB_STRATA; ++i) {
+        Stratum *s = &strata[i];
+        if (s->total == 0) continue;
+        double want = ratio * s->total;
+        size_t keep = (size_t)want;
+        double u = (double)(mix64(seed ^ (0xC2B2AE3D27D4EB4FULL * (i + 1))) >> 11) / (double)(1ULL << 53);
+        if (u < want - (double)keep) keep++;
+        if (keep == 0) {
+            dropped_strata++;
+            dropped_reqs += s->total;
+        }
+        size_t cum = 0;
+        s->cut_bin = NB_U_BINS;
+        for (size_t b = 0; b < NB_U_BINS; ++b) {
+            if (cum + s->u_hist[b] >= keep) {
+                s->cut_bin = b;
+                s->cut_frac = s->u_hist[b] ? (double)(keep - cum) / s->u_hist[b] : 0.0;
+                break;
+            }
+            cum += s->u_hist[b];
+        }
+    }
+
+    // Second pass: emit the selected requests in trace order
+    rewind(file);
+    long last_offset = -1;
+    printf("Nature_operation Offset Taille_requete\n");
+    printf("--------------------------------------\n");
+    while ((line_len = getline(&line, &len, file)) != -1) {
+        if (!trace_parse_line(line, line + line_len, &r)) continue;
+        if (!IS_DATA_OP(r.op_type)) {
+            printf("%d %ld %d %d\n", r.op_type, r.offset, r.length, r.file);
+            continue;
+        }
+        const Stratum *s = &strata[classify(last_offset, &r, region, seed, &h)];
+        last_offset = r.offset;
+        size_t bin = h >> 54;
+        // The low hash bits decide inside the boundary bin
+        double frac = (double)(h & ((1ULL << 54) - 1)) / (double)(1ULL << 54);
+        if (bin < s->cut_bin || (bin == s->cut_bin && frac < s->cut_frac)) {
+            if (r.file) printf("%d %ld %d %d\n", r.op_type, r.offset, r.length, r.file);
+            else printf("%d %ld %d\n", r.op_type, r.offset, r.length);
+            profile_add(&smp, &r);
+        }
+    }
+
+    free(line);
+    fclose(file);
+    for (size_t i = 0; i < NB_STRATA; ++i) free(strata[i].u_hist);
+    free(strata);
+
+    if (meta_ops) fprintf(stderr, "INFO: %zu metadata ops kept unsampled.\n", meta_ops);
+    if (dropped_strata)
+        fprintf(stderr, "INFO: %zu sparse strata (%zu requests) left out by the rounding.\n",
+                dropped_strata, dropped_reqs);
+    print_fidelity(&full, &smp);
+    return EXIT_SUCCESS;
+}
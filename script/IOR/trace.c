@@ -0,0 +1,435 @@
+/**
+ * trace.c
+ *
+ * Parsing of filtered I/O traces (see trace.h for the format), either
+ * loaded whole with load_trace or streamed in fixed-size chunks by a
+ * loader thread (trace_stream_*).
+ *
+ */
+
+#include "trace.h"
+#include <stdio.h>      // For perror.
+#include <stdlib.h>     // For malloc, realloc, free.
+#include <string.h>     // For memchr.
+#include <sys/mman.h>   // For the mmap function, used to map the trace file into memory.
+#include <sys/stat.h>   // For fstat, which gets file information.
+#include <fcntl.h>      // For open.
+#include <unistd.h>     // For close, read.
+#include <pthread.h>    // For the loader thread of the streaming reader.
+#include <time.h>       // For clock_gettime, used to time loader and replay stalls.
+
+#define STREAM_READ_SIZE (1 << 20)  /* Bytes read from the trace at a time by the loader */
+
+
+static const char *op_names[NB_OP_TYPES] = {
+    "read", "write", "open", "create", "close", "fsync", "fdatasync", "unlink"
+};
+
+
+/**
+ * @brief Returns the name of an operation code.
+ */
+const char *trace_op_name(int op) {
+    return (op >= 0 && op < NB_OP_TYPES) ? op_names[op] : "unknown";
+}
+
+
+/**
+ * @brief Parses a decimal integer, stopping at the end of the line.
+ * Leading blanks are skipped, but never a newline.
+ * @return 1 if a number was read, 0 otherwise.
+ */
+static int parse_field(const char **p, const char *end, long *out) {
+    const char *s = *p;
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    int neg = 0;
+    if (s < end && *s == '-') { neg = 1; s++; }
+    if (s >= end || *s < '0' || *s > '9') return 0;
+    long v = 0;
+    while (s < end && *s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    *out = neg ? -v : v;
+    *p = s;
+    return 1;
+}
+
+
+/**
+ * @brief Parses one request line of a filtered trace.
+ * Header lines and malformed lines are rejected. Parsing never reads past
+ * the end of the line nor past end, so it works on an mmap'ed trace.
+ * @param line The start of the line.
+ * @param end The end of the buffer holding the line.
+ * @param req Receives the parsed request.
+ * @return 1 if a request was parsed, 0 otherwise.
+ */
+int trace_parse_line(const char *line, const char *end, IOReq *req) {
+    const char *p = line;
+    long t, off, len, file = 0;
+    if (!parse_field(&p, end, &t) || !parse_field(&p, end, &off) || !parse_field(&p, end, &len))
+        return 0;
+    // The file id column is optional
+    if (!parse_field(&p, end, &file)) file = 0;
+    if (t < 0 || t >= NB_OP_TYPES || file < 0 || len < 0 || len > 0x7fffffff)
+        return 0;
+    if (IS_DATA_OP(t) && len == 0)
+        return 0;
+    req->op_type = (short)t;
+    req->offset  = off;
+    req->length  = (int)len;
+    req->file    = (int)file;
+    return 1;
+}
+
+
+/**
+ * @brief Loads an I/O trace from a file and stores it in an array.
+ * @param path The path to the trace file.
+ * @param reqs A pointer to a pointer of IOReq to store the array of requests.
+ * @return The number of requests loaded, or 0 on error.
+ */
+size_t load_trace(const char *path, IOReq **reqs) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open trace");
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return 0;
+    }
+    size_t filesize = (size_t)st.st_size;
+    if (filesize == 0) {
+        close(fd);
+        return 0;
+    }
+
+    // Map the file into memory for fast reading
+    char *data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return 0;
+    }
+
+    // Skip the first two header lines of the trace file
+    char *ptr = data;
+    char *end = data + filesize;
+    char *nl = memchr(ptr, '\n', end - ptr);
+    if (nl) ptr = nl + 1;
+    nl = memchr(ptr, '\n', end - ptr);
+    if (nl) ptr = nl + 1;
+
+    // Size the array from the number of lines, so that it is allocated once
+    size_t capacity = 1;
+    for (const char *c = ptr; (c = memchr(c, '\n', end - c)) != NULL; c++) capacity++;
+    IOReq *array = malloc(capacity * sizeof(IOReq));
+    if (!array) {
+        perror("malloc reqs");
+        munmap(data, filesize);
+        return 0;
+    }
+
+    // Read each line of the trace and parse it into an IOReq structure
+    size_t count = 0;
+    while (ptr < end && count < capacity) {
+        if (trace_parse_line(ptr, end, &array[count])) {
+            count++;
+        }
+        char *next = memchr(ptr, '\n', end - ptr);
+        if (!next) break;
+        ptr = next + 1;
+    }
+
+    // Unmap the memory
+    munmap(data, filesize);
+
+    if (count == 0) {
+        free(array);
+        *reqs = NULL;
+        return 0;
+    }
+    // Give back the room of header and malformed lines
+    IOReq *final = realloc(array, count * sizeof(IOReq));
+    *reqs = final ? final : array;
+    return count;
+}
+
+
+// A chunk of parsed requests
+typedef struct {
+    IOReq *reqs;
+    size_t count;
+} TraceChunk;
+
+// Streaming reader: a ring of nb_chunks chunks, filled by the loader thread
+// and consumed in order by the replay
+struct TraceStream {
+    int fd;
+    TraceChunk *chunks;
+    int nb_chunks;
+    size_t chunk_reqs;       /* Capacity of a chunk in requests */
+    int head;                /* Next chunk filled by the loader */
+    int tail;                /* Next chunk handed to the replay */
+    int filled;              /* Chunks filled and not yet handed to the replay */
+    int held;                /* The replay holds a chunk */
+    int done;                /* The loader reached the end of the trace (or failed) */
+    int stop;                /* trace_stream_close asks the loader to quit */
+    int started;             /* A chunk was already handed to the replay */
+    int running;             /* The loader thread was started */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t loader;
+    TraceStreamStats stats;
+};
+
+
+static double elapsed_us(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+
+/**
+ * @brief Waits until a chunk is free and returns it, or NULL if the stream is stopped.
+ */
+static TraceChunk *loader_acquire(TraceStream *s) {
+    pthread_mutex_lock(&s->lock);
+    if (!s->stop && s->filled + s->held + 1 > s->nb_chunks) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (!s->stop && s->filled + s->held + 1 > s->nb_chunks)
+            pthread_cond_wait(&s->not_full, &s->lock);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        s->stats.loader_waits++;
+        s->stats.loader_wait_us += elapsed_us(&t0, &t1);
+    }
+    TraceChunk *c = s->stop ? NULL : &s->chunks[s->head];
+    pthread_mutex_unlock(&s->lock);
+    if (c) c->count = 0;
+    return c;
+}
+
+
+/**
+ * @brief Hands a filled chunk to the replay. Empty chunks are kept for reuse.
+ */
+static void loader_publish(TraceStream *s, TraceChunk *c) {
+    pthread_mutex_lock(&s->lock);
+    if (c->count > 0) {
+        s->head = (s->head + 1) % s->nb_chunks;
+        s->filled++;
+        s->stats.requests += c->count;
+        pthread_cond_signal(&s->not_empty);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/**
+ * @brief Loader thread: reads the trace in STREAM_READ_SIZE blocks, parses
+ * complete lines into chunks and publishes each chunk when it is full.
+ * The trace pages already parsed are dropped from the page cache, so that
+ * a long trace does not compete with the replayed data for memory.
+ */
+static void *loader_main(void *arg) {
+    TraceStream *s = arg;
+    char *buf = malloc(STREAM_READ_SIZE);
+    if (!buf) {
+        perror("malloc stream buffer");
+        s->stats.error = 1;
+    }
+
+    struct timespec t0, t1;
+    size_t have = 0, lines = 0;
+    off_t pos = 0, dropped = 0;
+    int skip_line = 0, eof = 0;
+    TraceChunk *c = buf ? loader_acquire(s) : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (c && !eof) {
+        ssize_t got = read(s->fd, buf + have, STREAM_READ_SIZE - have);
+        if (got < 0) {
+            perror("read trace");
+            s->stats.error = 1;
+            break;
+        }
+        if (got == 0) {
+            eof = 1;
+            if (have > 0 && !skip_line) buf[have++] = '\n';  // last line without a newline
+        }
+        have += got;
+        pos += got;
+        posix_fadvise(s->fd, dropped, pos - dropped, POSIX_FADV_DONTNEED);
+        dropped = pos;
+
+        // Parse the complete lines of the block
+        char *ptr = buf, *end = buf + have, *nl;
+        while ((nl = memchr(ptr, '\n', end - ptr)) != NULL) {
+            if (!skip_line && lines >= 2 && trace_parse_line(ptr, nl, &c->reqs[c->count])) {
+                if (++c->count == s->chunk_reqs) {
+                    clock_gettime(CLOCK_MONOTONIC, &t1);
+                    s->stats.loader_busy_us += elapsed_us(&t0, &t1);
+                    loader_publish(s, c);
+                    c = loader_acquire(s);
+                    clock_gettime(CLOCK_MONOTONIC, &t0);
+                    if (!c) break;
+                }
+            }
+            if (!skip_line) lines++;
+            skip_line = 0;
+            ptr = nl + 1;
+        }
+        if (!c) break;
+
+        // Keep the incomplete last line for the next read. A line that fills
+        // the whole block is not a request line: drop it up to its newline.
+        have = end - ptr;
+        if (have == STREAM_READ_SIZE) {
+            have = 0;
+            skip_line = 1;
+        } else {
+            memmove(buf, ptr, have);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    s->stats.loader_busy_us += elapsed_us(&t0, &t1);
+    if (c) loader_publish(s, c);
+
+    pthread_mutex_lock(&s->lock);
+    s->done = 1;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+    free(buf);
+    return NULL;
+}
+
+
+/**
+ * @brief Opens a trace for streaming and starts its loader thread.
+ * At most nb_chunks * chunk_reqs requests are held in memory at any time:
+ * one chunk held by the replay, one being filled by the loader, the others
+ * waiting in the queue.
+ * @param path The path to the trace file.
+ * @param chunk_reqs The number of requests per chunk.
+ * @param nb_chunks The number of chunks (2 for double, 3 for triple buffering).
+ * @return The stream, or NULL on error.
+ */
+TraceStream *trace_stream_open(const char *path, size_t chunk_reqs, int nb_chunks) {
+    if (chunk_reqs == 0) chunk_reqs = 1;
+    if (nb_chunks < 2) nb_chunks = 2;
+
+    TraceStream *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc stream");
+        return NULL;
+    }
+    s->fd = open(path, O_RDONLY);
+    if (s->fd < 0) {
+        perror("open trace");
+        free(s);
+        return NULL;
+    }
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    s->nb_chunks = nb_chunks;
+    s->chunk_reqs = chunk_reqs;
+    s->chunks = calloc(nb_chunks, sizeof(TraceChunk));
+    for (int i = 0; s->chunks && i < nb_chunks; ++i) {
+        s->chunks[i].reqs = malloc(chunk_reqs * sizeof(IOReq));
+        if (!s->chunks[i].reqs) {
+            perror("malloc stream chunk");
+            s->done = 1;
+            break;
+        }
+    }
+    if (!s->chunks || s->done) {
+        if (!s->chunks) perror("calloc stream chunks");
+        s->done = 1;
+        trace_stream_close(s, NULL);
+        return NULL;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->not_empty, NULL);
+    pthread_cond_init(&s->not_full, NULL);
+    if (pthread_create(&s->loader, NULL, loader_main, s) != 0) {
+        perror("pthread_create loader");
+        s->done = 1;
+        trace_stream_close(s, NULL);
+        return NULL;
+    }
+    s->running = 1;
+    return s;
+}
+
+
+/**
+ * @brief Returns the next chunk of requests, waiting for the loader if needed.
+ * The chunk returned by the previous call is given back to the loader, so it
+ * must not be used any more. Time spent waiting after the first chunk is
+ * counted as a replay stall.
+ * @param s The stream.
+ * @param reqs Receives the requests of the chunk.
+ * @return The number of requests in the chunk, 0 at the end of the trace.
+ */
+size_t trace_stream_next(TraceStream *s, IOReq **reqs) {
+    pthread_mutex_lock(&s->lock);
+    if (s->held) {
+        s->held = 0;
+        pthread_cond_signal(&s->not_full);
+    }
+    if (s->filled == 0 && !s->done) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (s->filled == 0 && !s->done)
+            pthread_cond_wait(&s->not_empty, &s->lock);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (s->started) {
+            s->stats.replay_stalls++;
+            s->stats.replay_stall_us += elapsed_us(&t0, &t1);
+        } else {
+            s->stats.startup_us = elapsed_us(&t0, &t1);
+        }
+    }
+
+    size_t n = 0;
+    if (s->filled > 0) {
+        TraceChunk *c = &s->chunks[s->tail];
+        s->tail = (s->tail + 1) % s->nb_chunks;
+        s->filled--;
+        s->held = 1;
+        s->started = 1;
+        s->stats.chunks++;
+        *reqs = c->reqs;
+        n = c->count;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+
+/**
+ * @brief Stops the loader thread and frees the stream.
+ * @param s The stream.
+ * @param stats Receives the loader and stall statistics (may be NULL).
+ */
+void trace_stream_close(TraceStream *s, TraceStreamStats *stats) {
+    if (!s) return;
+    if (s->running) {
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_signal(&s->not_full);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->loader, NULL);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->not_empty);
+        pthread_cond_destroy(&s->not_full);
+    }
+    if (stats) *stats = s->stats;
+    for (int i = 0; s->chunks && i < s->nb_chunks; ++i) free(s->chunks[i].reqs);
+    free(s->chunks);
+    if (s->fd >= 0) close(s->fd);
+    free(s);
+}
@@ -0,0 +1,75 @@
+/**
+ * trace.h
+ *
+ * Filtered trace format shared by the replay and trace tools.
+ *
+ * A filtered trace (as produced by filter_traces.c) starts with two header
+ * lines, followed by one request per line: "<op> <offset> <length> [<file>]".
+ * op is one of the TraceOp codes below. file identifies the file the request
+ * applies to: 0 is the replay data file, other ids are files created by the
+ * replay in its scratch directory. It defaults to 0 when the column is absent,
+ * which keeps the original three-column read/write traces valid. Metadata and
+ * durability ops carry an offset and a length of 0, except opens and creates
+ * whose length is TRACE_OPEN_TRUNC when the traced call truncated the file.
+ *
+ * A trace is either loaded whole (load_trace) or streamed (trace_stream_*):
+ * a loader thread parses it into a ring of fixed-size chunks that the replay
+ * consumes in order, so memory stays bounded whatever the trace length.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>     // For size_t.
+
+// Operation codes of the trace format
+typedef enum {
+    OP_READ      = 0,
+    OP_WRITE     = 1,
+    OP_OPEN      = 2,   /* open of an existing file */
+    OP_CREATE    = 3,   /* open with O_CREAT, or creat() */
+    OP_CLOSE     = 4,
+    OP_FSYNC     = 5,
+    OP_FDATASYNC = 6,
+    OP_UNLINK    = 7,
+    NB_OP_TYPES
+} TraceOp;
+
+// Structure representing a single I/O request
+typedef struct {
+    long  offset;        /* The offset in bytes from the start of the file */
+    int   length;        /* The length of the operation in bytes */
+    int   file;          /* The file id (0 for the data file) */
+    short op_type;       /* One of TraceOp */
+} IOReq;
+
+#define IS_DATA_OP(op) ((op) == OP_READ || (op) == OP_WRITE)
+
+// Length column of OP_OPEN / OP_CREATE: the traced call had O_TRUNC
+#define TRACE_OPEN_TRUNC 1
+
+// Loader and stall counters of a streamed trace
+typedef struct {
+    size_t requests;         /* Requests parsed by the loader */
+    size_t chunks;           /* Chunks handed to the replay */
+    double startup_us;       /* Wait for the first chunk */
+    size_t replay_stalls;    /* Times the replay waited for the loader after the first chunk */
+    double replay_stall_us;  /* Time the replay spent waiting for the loader */
+    size_t loader_waits;     /* Times the loader waited for a free chunk (window full) */
+    double loader_wait_us;   /* Time the loader spent waiting for a free chunk */
+    double loader_busy_us;   /* Time the loader spent reading and parsing */
+    int    error;            /* The trace could not be read to the end */
+} TraceStreamStats;
+
+typedef struct TraceStream TraceStream;
+
+int trace_parse_line(const char *line, const char *end, IOReq *req);
+size_t load_trace(const char *path, IOReq **reqs);
+const char *trace_op_name(int op);
+
+TraceStream *trace_stream_open(const char *path, size_t chunk_reqs, int nb_chunks);
+size_t trace_stream_next(TraceStream *s, IOReq **reqs);
+void trace_stream_close(TraceStream *s, TraceStreamStats *stats);
+
+#endif // TRACE_H
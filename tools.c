@@ -37,6 +37,25 @@ void parse_args(int argc, char **argv, AppConfig *config) {
     config->data_file_path = "/tmp/iortest.file";
     config->log_prefix = "log_iortest";
     config->data_file_size = 256 * 1024 * 1024; // 256M
+    config->engine = ENGINE_SYSCALL;
+    config->madvise_hint = MADV_HINT_NONE;
+    config->drop_policy = DROP_CACHE_OP;
+    config->bounce_pool = 4;
+    config->align = 512;
+    config->write_pattern = WRITE_PATTERN_RANDOM;
+    config->compress_ratio = 2.0;
+    config->write_pool = 16;
+    config->write_select = WRITE_SELECT_ROTATE;
+    config->open_mode = OPEN_SYNC_DIRECT;
+    config->scratch_dir = NULL;
+    config->stream = 0;
+    config->stream_window = 256 * 1024;
+    config->stream_buffers = 3;
+    config->cpu_counters = CPU_COUNTERS_NONE;
+    config->cache_check = CACHE_CHECK_RUN;
+    config->cache_interval = 0;
+    config->extents = 0;
+    config->latency_log = NULL;
 
     // On utilise un parsing manuel simple, plus proche de votre original
     for (int i = 1; i < argc; i++) {
@@ -58,6 +77,99 @@ void parse_args(int argc, char **argv, AppConfig *config) {
             i++; if (i < argc) config->trace_path = argv[i];
         } else if (!strcmp(argv[i], "--data-file")) { // Ajout de l'option --data-file
             i++; if (i < argc) config->data_file_path = argv[i];
+        } else if (!strcmp(argv[i], "--engine")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "syscall")) config->engine = ENGINE_SYSCALL;
+            else if (!strcmp(argv[i], "mmap")) config->engine = ENGINE_MMAP;
+            else if (!strcmp(argv[i], "bounce")) config->engine = ENGINE_BOUNCE;
+            else { fprintf(stderr, "Moteur inconnu : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--madvise")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "none")) config->madvise_hint = MADV_HINT_NONE;
+            else if (!strcmp(argv[i], "random")) config->madvise_hint = MADV_HINT_RANDOM;
+            else if (!strcmp(argv[i], "sequential")) config->madvise_hint = MADV_HINT_SEQUENTIAL;
+            else if (!strcmp(argv[i], "willneed")) config->madvise_hint = MADV_HINT_WILLNEED;
+            else { fprintf(stderr, "Conseil madvise inconnu : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--bounce-pool")) {
+            i++; if (i < argc) config->bounce_pool = get_val_arg(argv[i]);
+            if (config->bounce_pool == 0) config->bounce_pool = 1;
+        } else if (!strcmp(argv[i], "--align")) {
+            i++; if (i < argc) config->align = get_val_arg(argv[i]);
+            if (config->align == 0 || (config->align & (config->align - 1))) {
+                fprintf(stderr, "L'alignement doit être une puissance de deux\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--write-pattern")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "random")) config->write_pattern = WRITE_PATTERN_RANDOM;
+            else if (!strcmp(argv[i], "compressible")) config->write_pattern = WRITE_PATTERN_COMPRESSIBLE;
+            else if (!strcmp(argv[i], "zero")) config->write_pattern = WRITE_PATTERN_ZERO;
+            else if (!strcmp(argv[i], "fill")) config->write_pattern = WRITE_PATTERN_FILL;
+            else { fprintf(stderr, "Motif d'écriture inconnu : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--compress-ratio")) {
+            i++; if (i < argc) config->compress_ratio = atof(argv[i]);
+            if (config->compress_ratio < 1.0) {
+                fprintf(stderr, "Le taux de compression doit être >= 1\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--write-pool")) {
+            i++; if (i < argc) config->write_pool = get_val_arg(argv[i]);
+            if (config->write_pool == 0) config->write_pool = 1;
+        } else if (!strcmp(argv[i], "--write-select")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "rotate")) config->write_select = WRITE_SELECT_ROTATE;
+            else if (!strcmp(argv[i], "hash")) config->write_select = WRITE_SELECT_HASH;
+            else { fprintf(stderr, "Sélection de tampon inconnue : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--open-mode")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "sync-direct")) config->open_mode = OPEN_SYNC_DIRECT;
+            else if (!strcmp(argv[i], "direct")) config->open_mode = OPEN_DIRECT;
+            else if (!strcmp(argv[i], "buffered")) config->open_mode = OPEN_BUFFERED;
+            else { fprintf(stderr, "Mode d'ouverture inconnu : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--scratch-dir")) {
+            i++; if (i < argc) config->scratch_dir = argv[i];
+        } else if (!strcmp(argv[i], "--stream")) {
+            config->stream = 1;
+        } else if (!strcmp(argv[i], "--stream-window")) {
+            i++; if (i < argc) config->stream_window = get_val_arg(argv[i]);
+        } else if (!strcmp(argv[i], "--stream-buffers")) {
+            i++; if (i < argc) config->stream_buffers = atoi(argv[i]);
+            if (config->stream_buffers < 2 || config->stream_buffers > 3) {
+                fprintf(stderr, "Le nombre de blocs de flux doit être 2 ou 3\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--cpu-counters")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "none")) config->cpu_counters = CPU_COUNTERS_NONE;
+            else if (!strcmp(argv[i], "auto")) config->cpu_counters = CPU_COUNTERS_AUTO;
+            else if (!strcmp(argv[i], "rusage")) config->cpu_counters = CPU_COUNTERS_RUSAGE;
+            else { fprintf(stderr, "Mode de compteurs CPU inconnu : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--cache-check")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "none")) config->cache_check = CACHE_CHECK_NONE;
+            else if (!strcmp(argv[i], "run")) config->cache_check = CACHE_CHECK_RUN;
+            else if (!strcmp(argv[i], "op")) config->cache_check = CACHE_CHECK_OP;
+            else { fprintf(stderr, "Vérification de cache inconnue : %s\n", argv[i]); exit(1); }
+        } else if (!strcmp(argv[i], "--cache-interval")) {
+            i++; if (i < argc) config->cache_interval = get_val_arg(argv[i]);
+        } else if (!strcmp(argv[i], "--extents")) {
+            config->extents = 1;
+        } else if (!strcmp(argv[i], "--latency-log")) {
+            i++; if (i < argc) config->latency_log = argv[i];
+        } else if (!strcmp(argv[i], "--drop-cache")) {
+            i++;
+            if (i >= argc) continue;
+            if (!strcmp(argv[i], "op")) config->drop_policy = DROP_CACHE_OP;
+            else if (!strcmp(argv[i], "start")) config->drop_policy = DROP_CACHE_START;
+            else if (!strcmp(argv[i], "none")) config->drop_policy = DROP_CACHE_NONE;
+            else { fprintf(stderr, "Politique de vidage inconnue : %s\n", argv[i]); exit(1); }
         } else if (!strcmp(argv[i], "--help")) {
             fprintf(stderr, "Usage: %s --mode <read|write|replay> [options]\n", argv[0]);
             fprintf(stderr, "\n--- Options de Génération ---\n");
@@ -67,6 +179,29 @@ void parse_args(int argc, char **argv, AppConfig *config) {
             fprintf(stderr, "\n--- Options de Rejeu ---\n");
             fprintf(stderr, "  --trace-file <path>    Chemin du fichier de trace (défaut: filtered_trace.log)\n");
             fprintf(stderr, "  --data-file <path>     Chemin du fichier de données pour le rejeu (défaut: /tmp/iortest.file)\n"); // Ajout de l'aide
+            fprintf(stderr, "  --engine <syscall|mmap|bounce> Moteur de rejeu : read/write O_DIRECT, accès via mmap,\n");
+            fprintf(stderr, "                         ou O_DIRECT avec tampons de rebond pour les requêtes non alignées (défaut: syscall)\n");
+            fprintf(stderr, "  --bounce-pool <N>      Nombre de tampons de rebond alignés (défaut: 4)\n");
+            fprintf(stderr, "  --align <N>            Alignement O_DIRECT en octets, puissance de deux (défaut: 512)\n");
+            fprintf(stderr, "  --madvise <mode>       Conseil mmap : none, random, sequential ou willneed (défaut: none)\n");
+            fprintf(stderr, "  --drop-cache <mode>    Vidage du cache : op (chaque opération), start ou none (défaut: op)\n");
+            fprintf(stderr, "  --cache-check <mode>   Résidence en cache du fichier de données : none, run (avant/après)\n");
+            fprintf(stderr, "                         ou op (et avant chaque lecture) (défaut: run)\n");
+            fprintf(stderr, "  --cache-interval <N>   Mesure de la résidence toutes les N opérations (défaut: 0, désactivé)\n");
+            fprintf(stderr, "  --extents              Seeks physiques et fragmentation du fichier de données (FIEMAP)\n");
+            fprintf(stderr, "  --latency-log <path>   Écrit la latence de chaque lecture/écriture (µs, une par ligne) pour compare_runs\n");
+            fprintf(stderr, "  --open-mode <mode>     Ouverture : sync-direct (O_SYNC|O_DIRECT), direct ou buffered (défaut: sync-direct)\n");
+            fprintf(stderr, "  --scratch-dir <path>   Répertoire des fichiers créés par les opérations de métadonnées\n");
+            fprintf(stderr, "                         (défaut: <répertoire du fichier de données>/iortest_scratch)\n");
+            fprintf(stderr, "  --cpu-counters <mode>  Coût CPU par opération : none, auto (perf_event, repli getrusage)\n");
+            fprintf(stderr, "                         ou rusage (défaut: none)\n");
+            fprintf(stderr, "  --stream               Lit la trace en flux pendant le rejeu (mémoire bornée)\n");
+            fprintf(stderr, "  --stream-window <N>    Requêtes gardées en mémoire en mode flux (ex: 64k, 1M) (défaut: 256k)\n");
+            fprintf(stderr, "  --stream-buffers <N>   Blocs de la fenêtre : 2 (double) ou 3 (triple tampon) (défaut: 3)\n");
+            fprintf(stderr, "  --write-pattern <mode> Contenu écrit : random, compressible, zero ou fill (défaut: random)\n");
+            fprintf(stderr, "  --compress-ratio <R>   Taux de compression visé par le motif compressible (défaut: 2.0)\n");
+            fprintf(stderr, "  --write-pool <N>       Nombre de tampons d'écriture pré-générés (défaut: 16)\n");
+            fprintf(stderr, "  --write-select <mode>  Choix du tampon : rotate ou hash de l'offset (défaut: rotate)\n");
             fprintf(stderr, "\n--- Options Communes ---\n");
             fprintf(stderr, "  --filesize <N>         Taille du fichier de données (ex: 256M, 4G) (défaut: 256M)\n");
             exit(0);
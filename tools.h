@@ -22,6 +22,63 @@ typedef enum {
     MODE_REPLAY
 } BenchMode;
 
+// Moteur utilisé pour rejouer les requêtes de la trace
+typedef enum {
+    ENGINE_SYSCALL,   // read/write sur un descripteur O_DIRECT
+    ENGINE_MMAP,      // accès mémoire sur une projection du fichier de données
+    ENGINE_BOUNCE     // O_DIRECT avec tampons alignés pour les requêtes non alignées
+} ReplayEngine;
+
+// Conseil madvise appliqué à la projection (moteur mmap)
+typedef enum {
+    MADV_HINT_NONE,
+    MADV_HINT_RANDOM,
+    MADV_HINT_SEQUENTIAL,
+    MADV_HINT_WILLNEED
+} MadviseHint;
+
+// Contenu des tampons d'écriture
+typedef enum {
+    WRITE_PATTERN_RANDOM,        // incompressible
+    WRITE_PATTERN_COMPRESSIBLE,  // taux de compression cible (--compress-ratio)
+    WRITE_PATTERN_ZERO,          // tout à zéro
+    WRITE_PATTERN_FILL           // octets 'B' identiques (ancien comportement)
+} WritePattern;
+
+// Choix du tampon d'écriture pour chaque requête
+typedef enum {
+    WRITE_SELECT_ROTATE,   // tampons utilisés à tour de rôle
+    WRITE_SELECT_HASH      // tampon choisi par hachage de l'offset
+} WriteSelect;
+
+// Drapeaux d'ouverture des fichiers rejoués (moteurs syscall et bounce)
+typedef enum {
+    OPEN_SYNC_DIRECT,  // O_SYNC | O_DIRECT (comportement d'origine)
+    OPEN_DIRECT,       // O_DIRECT seul : fsync/fdatasync ont un coût réel
+    OPEN_BUFFERED      // E/S via le cache de pages
+} OpenMode;
+
+// Compteurs de coût CPU par opération
+typedef enum {
+    CPU_COUNTERS_NONE,   // pas de compteurs (comportement d'origine)
+    CPU_COUNTERS_AUTO,   // perf_event_open, repli sur getrusage si indisponible
+    CPU_COUNTERS_RUSAGE  // getrusage uniquement
+} CpuCounterMode;
+
+// Vérification de la résidence en cache de pages du fichier de données
+typedef enum {
+    CACHE_CHECK_NONE,    // pas de vérification
+    CACHE_CHECK_RUN,     // avant et après le rejeu (et par intervalle)
+    CACHE_CHECK_OP       // en plus, sonde la plage de chaque lecture (taux de succès estimé)
+} CacheCheck;
+
+// Politique de vidage du cache de pages pendant le rejeu
+typedef enum {
+    DROP_CACHE_OP,     // avant le rejeu puis après chaque opération
+    DROP_CACHE_START,  // uniquement avant le rejeu
+    DROP_CACHE_NONE    // jamais
+} CacheDropPolicy;
+
 // Structure pour stocker la configuration de l'application
 typedef struct {
     BenchMode mode;
@@ -33,6 +90,25 @@ typedef struct {
     char *data_file_path;
     char *log_prefix;
     size_t data_file_size;
+    ReplayEngine engine;
+    MadviseHint madvise_hint;
+    CacheDropPolicy drop_policy;
+    size_t bounce_pool;   // nombre de tampons de rebond (moteur bounce)
+    size_t align;         // alignement exigé par O_DIRECT, en octets
+    WritePattern write_pattern;
+    double compress_ratio; // taux de compression visé (motif compressible)
+    size_t write_pool;     // nombre de tampons d'écriture pré-générés
+    WriteSelect write_select;
+    OpenMode open_mode;
+    char *scratch_dir;    // répertoire des fichiers créés par le rejeu (NULL : à côté du fichier de données)
+    int stream;           // lecture de la trace en flux par un thread de chargement
+    size_t stream_window; // nombre maximal de requêtes en mémoire en mode flux
+    int stream_buffers;   // nombre de blocs de la fenêtre (2 : double, 3 : triple tampon)
+    CpuCounterMode cpu_counters;
+    CacheCheck cache_check;
+    size_t cache_interval; // échantillon de résidence toutes les N opérations (0 : désactivé)
+    int extents;          // distances de seek physiques via FIEMAP
+    char *latency_log;    // fichier des latences par opération, en µs (NULL : pas de journal)
 } AppConfig;
 
 // Structure pour stocker les résultats statistiques